@@ -0,0 +1,209 @@
+//  cidrtest.c
+//  cidrtest
+//
+//  Created by Dr. Rolf Jansen on 2026-10-16.
+//  Copyright © 2026 projectworld.net. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification,
+//  are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS
+//  OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+//  AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER
+//  OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+//  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+//  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+//  IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+//  THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  make cidrtest && ./cidrtest  -- or make test
+//
+//  Cross checks the CIDR decomposition of the IP ranges by rangeIP4Prefixes() and rangeIP6Prefixes() against
+//  the former decomposition loop of ipup -t, exhaustively for all the ranges within the first and the last 4096
+//  IPv4 addresses, and within the first, a middle and the last 512 IPv6 addresses, and for random ranges otherwise.
+//  Each decomposition must cover the range exactly by aligned prefixes in ascending order, and it must be the one
+//  of the former loop, except for the final single address of a range, which the former loop dropped, because it
+//  continued only while the next address was < hi. The former loop also wrapped around at the end of the address
+//  space, so here it stops there, and it could not decompose the whole IPv6 address space, which is checked only
+//  for the exact cover.
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#include "binutils.h"
+#include "store.h"
+#include "testutils.h"
+
+
+// The former loop of ipup -t, which stops here at the end of the address space.
+static int formerIP4Prefixes(uint32_t lo, uint32_t hi, IP4Prefix *prefixes)
+{
+   uint32_t ip = lo;
+   int32_t  m, n = 0;
+   do
+   {
+      m = intlb4_1p(hi - ip);
+      while (ip - (ip >> m << m))
+         m--;
+      prefixes[n++] = (IP4Prefix){ip, m};
+   }
+   while (m < 32 && (ip += (uint32_t)1<<m) != 0 && ip < hi);
+
+   return n;
+}
+
+static int formerIP6Prefixes(uint128t lo, uint128t hi, IP6Prefix *prefixes)
+{
+   uint128t ip = lo;
+   int32_t  m, n = 0;
+   do
+   {
+      m = intlb6_1p(sub_u128(hi, ip));
+      while (gt_u128(sub_u128(ip, shl_u128(shr_u128(ip, m), m)), u64_to_u128t(0)))
+         m--;
+      prefixes[n++] = (IP6Prefix){ip, m};
+   }
+   while (m < 128 && gt_u128(ip = add_u128(ip, shl_u128(u64_to_u128t(1), m)), u64_to_u128t(0)) && lt_u128(ip, hi));
+
+   return n;
+}
+
+static long errors = 0, dropped = 0;
+
+static void checkIP4(uint32_t lo, uint32_t hi)
+{
+   IP4Prefix prefixes[maxIP4Prefixes], former[maxIP4Prefixes];
+   int       i, n = rangeIP4Prefixes(lo, hi, prefixes), f = formerIP4Prefixes(lo, hi, former);
+   uint64_t  next = lo;
+
+   for (i = 0; i < n; i++)
+   {
+      uint32_t ip = prefixes[i].ip;
+      int32_t  m  = prefixes[i].m;
+      if (ip != next || m < 0 || m > 32 || m < 32 && ip & (((uint32_t)1 << m) - 1))
+         break;
+      next += (uint64_t)1 << m;
+   }
+
+   if (i < n || next != (uint64_t)hi + 1)
+   {
+      if (errors++ < 10)
+         printf("IPv4 %08X - %08X: no exact cover by %d prefixes\n", lo, hi, n);
+      return;
+   }
+
+   // the former loop may only miss the final single address prefix
+   if (f == n - 1 && prefixes[n-1].m == 0 && prefixes[n-1].ip == hi)
+      dropped++, n--;
+
+   if (f != n || memcmp(prefixes, former, n*sizeof(IP4Prefix)) != 0)
+      if (errors++ < 10)
+         printf("IPv4 %08X - %08X: %d prefixes, but %d by the former loop\n", lo, hi, n, f);
+}
+
+static void checkIP6(uint128t lo, uint128t hi, bool compare)
+{
+   IP6Prefix prefixes[maxIP6Prefixes], former[maxIP6Prefixes];
+   int       i, n = rangeIP6Prefixes(lo, hi, prefixes), f = formerIP6Prefixes(lo, hi, former);
+   uint128t  next = lo;
+   bool      wrapped = false;
+
+   for (i = 0; i < n && !wrapped; i++)
+   {
+      uint128t ip = prefixes[i].ip;
+      int32_t  m  = prefixes[i].m;
+      if (!eq_u128(ip, next) || m < 0 || m > 128 || m < 128 && !eq_u128(shl_u128(shr_u128(ip, m), m), ip))
+         break;
+      if (m == 128)
+         wrapped = true;
+      else
+         wrapped = eq_u128(next = add_u128(next, shl_u128(u64_to_u128t(1), m)), u64_to_u128t(0));
+   }
+
+   if (i < n || !(wrapped && eq_u128(hi, sub_u128(u64_to_u128t(0), u64_to_u128t(1)))
+                  || !wrapped && eq_u128(next, add_u128(hi, u64_to_u128t(1)))))
+   {
+      if (errors++ < 10)
+         printf("IPv6 range: no exact cover by %d prefixes\n", n);
+      return;
+   }
+
+   if (!compare)
+      return;
+
+   if (f == n - 1 && prefixes[n-1].m == 0 && eq_u128(prefixes[n-1].ip, hi))
+      dropped++, n--;
+
+   for (i = 0; i < n && i < f; i++)
+      if (!eq_u128(prefixes[i].ip, former[i].ip) || prefixes[i].m != former[i].m)
+         break;
+
+   if (f != n || i < n)
+      if (errors++ < 10)
+         printf("IPv6 range: %d prefixes, but %d by the former loop\n", n, f);
+}
+
+int main(int argc, const char *argv[])
+{
+   uint32_t lo, hi;
+   long     checks = 0;
+   int      i;
+
+   // all the ranges within the first and the last 4096 addresses
+   for (lo = 0; lo < 4096; lo++)
+      for (hi = lo; hi < 4096; hi++, checks += 2)
+      {
+         checkIP4(lo, hi);
+         checkIP4(~hi, ~lo);
+      }
+
+   // random ranges of random widths
+   for (i = 0; i < 2000000; i++, checks++)
+   {
+      lo = (uint32_t)xorshift();
+      hi = lo + (uint32_t)(xorshift() >> (32 + xorshift() % 32));
+      checkIP4((lo <= hi) ? lo : hi, (lo <= hi) ? hi : lo);
+   }
+
+   checkIP4(0, UINT32_MAX);
+   printf("IPv4: %ld ranges checked, %ld final single addresses dropped by the former loop, %ld errors\n", checks, dropped, errors);
+
+   checks = dropped = 0;
+
+   // the small ranges at the beginning, in the middle and at the end of the address space
+   for (lo = 0; lo < 512; lo++)
+      for (hi = lo; hi < 512; hi++, checks += 3)
+      {
+         checkIP6(u64_to_u128t(lo), u64_to_u128t(hi), true);
+         checkIP6(u128(1, lo), u128(1, hi), true);
+         checkIP6(u128(UINT64_MAX, UINT64_MAX - hi), u128(UINT64_MAX, UINT64_MAX - lo), true);
+      }
+
+   // random ranges of random widths in both halves
+   for (i = 0; i < 500000; i++, checks++)
+   {
+      uint128t a = u128(xorshift(), xorshift()),
+               w = shr_u128(u128(xorshift(), xorshift()), (uint32_t)(xorshift() % 128)),
+               b = add_u128(a, w);
+      if (lt_u128(b, a))
+         b = sub_u128(u64_to_u128t(0), u64_to_u128t(1));
+      checkIP6(a, b, true);
+   }
+
+   checkIP6(u64_to_u128t(0), sub_u128(u64_to_u128t(0), u64_to_u128t(1)), false);
+   printf("IPv6: %ld ranges checked, %ld final single addresses dropped by the former loop, %ld errors\n", checks, dropped, errors);
+
+   return (errors) ? 1 : 0;
+}
@@ -33,13 +33,25 @@
 #include <fcntl.h>
 #include <signal.h>
 #include <string.h>
+#include <sched.h>
+#include <pthread.h>
 #include <syslog.h>
+#include <time.h>
 #include <unistd.h>
+#include <stddef.h>
 #include <netinet/in.h>
 #include <netinet/ip.h>
+#include <netinet/ip6.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/un.h>
+
+#if defined(__FreeBSD__)
+   #include <pthread_np.h>
+   #include <sys/cpuset.h>
+   typedef cpuset_t cpu_set_t;
+#endif
 
 #include "binutils.h"
 #include "store.h"
@@ -48,23 +60,52 @@
 
 const char *pidfname = "/var/run/"DAEMON_NAME".pid";
 
+int controlPipe[2] = {-1, -1};
+
 
 void usage(const char *executable)
 {
    const char *r = executable + strvlen(executable);
    while (--r >= executable && *r != '/'); r++;
    printf("%s v1.0 ("SVNREV"), Copyright © 2016 Dr. Rolf Jansen\n", r);
-   printf("Usage:  %s [-a AA:BB:..] [-d DD:EE:..] [-r bstfile] [-p pidfile] [-f] [-n] [-h]\n", r);
-   printf(" -a AA:BB:.. allow IPv4 source addresses from the listed countries,\n");
+   printf("Usage:  %s [-a AA:BB:..] [-d DD:EE:..] [-e engine] [-b] [-i backend[:arg]] [-w workers] [-c cpus] [-s] [-v entries] [-r bstfiles] [-p pidfile] [-f] [-n] [-h]\n", r);
+   printf(" -a AA:BB:.. allow IPv4 and IPv6 source addresses from the listed countries,\n");
    printf("             i.e, 2 letter capital country codes, separated by colon.\n");
-   printf(" -d DD:EE:.. deny IPv4 source addresses from the listed countries.\n");
+   printf(" -d DD:EE:.. deny IPv4 and IPv6 source addresses from the listed countries.\n");
    printf("             NOTE: the -a and the -d option are mutually exclusive.\n");
-   printf(" -r bstfile  the path to the binary file with the consolidated IP ranges that has been.\n");
-   printf("             generated by the 'ipdb' tool [default: /usr/local/etc/ipdb/IPRanges/ipcc.bst].\n");
+   printf(" -e engine   the lookup engine of the compiled policy [default: bisection], either one for both IP\n");
+   printf("  | v4:v6    versions, or one per IP version separated by colon:\n");
+   printf("             bisection - binary search in the sorted table.\n");
+   printf("             eytzinger - branchless search in the Eytzinger layout of the sorted table.\n");
+   printf("             stree     - SIMD search in a static 16-ary B-tree (IPv4 only).\n");
+   printf("             dir16 .. dir24 - direct indexed table of 2^16 (256 kB) up to 2^24 (64 MB) slots (IPv4 only).\n");
+   printf("             learned   - piecewise linear model of the positions in the sorted table (IPv4 only).\n");
+   printf("             poptrie   - compressed multibit trie with a 2^20 slots direct table (IPv6 only).\n");
+   printf(" -b          bitmap mode, look up the verdicts in a 2 MB bitmap of the /24 networks, and only the /24\n");
+   printf("             networks with denied and passed addresses in the intervals of the compiled policy.\n");
+   printf(" -i backend  the packet I/O backend [default: divert:8669, if available]:\n");
+   printf("             divert[:port]  - receive and reinject the packets by the divert socket at the given port.\n");
+   printf("             pcap:in[,out]  - replay the packets in the pcap file 'in', and write the passed ones to the\n");
+   printf("                              pcap file 'out', if given. At the end of the file, log the counts and exit.\n");
+   printf("             unix:path      - receive IP packets by datagrams at the given AF_UNIX socket path, and reply\n");
+   printf("                              to the sender the verdict by a datagram of 1 byte, 1 = passed, 0 = denied.\n");
+   printf(" -w workers  the number of worker threads [default: 0], which classify the packets, while one thread\n");
+   printf("             receives and another one returns the packets in the order of their reception.\n");
+   printf("             0 means, receive, classify and return the packets in a single thread.\n");
+   printf(" -c cpus     pin the receiver, the sender and the worker threads in this order to the CPUs in the list\n");
+   printf("             separated by comma, e.g. 0,1,2,3 -- the list is reused round robin if it is shorter.\n");
+   printf(" -s          count the passed and denied packets per country, at the cost of a lookup of the\n");
+   printf("             country of each packet in the IP ranges, which are kept in memory for this.\n");
+   printf(" -v entries  the size of the verdict cache of the recent IPv4 sources per thread [default: 4096], a power\n");
+   printf("             of 2 from 64 to 16777216 entries of 8 bytes, or 0 for disabling the cache.\n");
+   printf(" -r bstfiles base path to the binary sorted tables (.v4 and .v6) with the consolidated IP ranges\n");
+   printf("             which were generated by the 'ipdb' tool [default: /usr/local/etc/ipdb/IPRanges/ipcc.bst].\n");
    printf(" -p pidfile  the path to the pid file [default: /var/run/"DAEMON_NAME".pid].\n");
    printf(" -f          foreground mode, don't fork off as a daemon.\n");
    printf(" -n          no console, don't fork off as a daemon - started/managed by initd, launchd, etc.\n");
    printf(" -h          show these usage instructions.\n\n");
+   printf("On SIGHUP, the IP ranges are reloaded from the bstfiles and replace the current ones without interruption.\n");
+   printf("On SIGUSR1, the packet counts and the latency histogram of the classification are logged.\n\n");
 }
 
 
@@ -73,10 +114,11 @@ static void signals(int sig)
    switch (sig)
    {
       case SIGHUP:
-         syslog(LOG_ERR, "Received SIGHUP signal.");
-         kill(0, SIGHUP);
-         unlink(pidfname);
-         exit(0);
+         write(controlPipe[1], "H", 1);         // wake up the control thread for reloading the IP ranges
+         break;
+
+      case SIGUSR1:
+         write(controlPipe[1], "U", 1);         // wake up the control thread for dumping the statistics
          break;
 
       case SIGINT:
@@ -120,10 +162,14 @@ void daemonize(DaemonKind kind)
    switch (kind)
    {
       case noDaemon:
-         openlog(DAEMON_NAME, LOG_NDELAY | LOG_PID | LOG_CONS, LOG_USER);
+         signal(SIGHUP,  signals);
+         signal(SIGUSR1, signals);
+         openlog(DAEMON_NAME, LOG_NDELAY | LOG_PID | LOG_CONS | LOG_PERROR, LOG_USER);
          break;
 
       case launchdDaemon:
+         signal(SIGHUP,  signals);
+         signal(SIGUSR1, signals);
          signal(SIGTERM, signals);
          openlog(DAEMON_NAME, LOG_NDELAY | LOG_PID, LOG_USER);
          break;
@@ -172,6 +218,7 @@ void daemonize(DaemonKind kind)
          write(pidfile, s, l);      // record pid to our pid file
 
          signal(SIGHUP,  signals);
+         signal(SIGUSR1, signals);
          signal(SIGINT,  signals);
          signal(SIGQUIT, signals);
          signal(SIGTERM, signals);
@@ -187,27 +234,1024 @@ void daemonize(DaemonKind kind)
 }
 
 
-bool allowMatch = true;
+// Packet I/O backends -- receive a packet, and depending on its verdict reinject it or record the verdict
+
+#define packetSize (IP_MAXPACKET + 64)    // room for the link layer header of pcap records
+
+typedef struct
+{
+   ssize_t   len;                         // the length of the frame in data
+   int       ip;                          // the offset of the IP header in data, or -1 for non-IP frames
+   uint32_t  ts[2];                       // the time stamp of a pcap record
+   bool      pass;                        // the verdict
+   socklen_t addrlen;
+   union
+   {
+      struct sockaddr    sa;
+      struct sockaddr_in in;
+      struct sockaddr_un un;
+   } addr;                                // the address of the sender, to which the packet or the verdict is returned
+   uint8_t   data[packetSize];
+} Packet;
+
+typedef struct PacketIO
+{
+   const char *name;
+   bool (*open)(struct PacketIO *io, char *arg);
+   int  (*receive)(struct PacketIO *io, Packet *pkt);          // 1 = received, 0 = end of input, -1 = error
+   bool (*verdict)(struct PacketIO *io, Packet *pkt, bool pass);
+   void (*close)(struct PacketIO *io);
+
+   int      sock;
+   FILE    *in, *out;
+   bool     swapped;                      // the byte order of the pcap file is not the host's one
+   uint32_t linktype;
+   char    *path;
+} PacketIO;
+
+
+#if defined(IPPROTO_DIVERT)
+
+static bool divertOpen(PacketIO *io, char *arg)
+{
+   struct sockaddr_in divertAddress = {};
+   divertAddress.sin_family = AF_INET;
+   divertAddress.sin_port   = htons((arg && *arg) ? (uint16_t)strtol(arg, NULL, 10) : 8669);
+
+   if ((io->sock = socket(PF_INET, SOCK_RAW, IPPROTO_DIVERT)) < 0)
+      return false;
+
+   return bind(io->sock, (struct sockaddr *)&divertAddress, sizeof(divertAddress)) == 0;
+}
+
+static int divertReceive(PacketIO *io, Packet *pkt)
+{
+   pkt->addrlen = sizeof(pkt->addr);
+   pkt->ip = 0;
+   return ((pkt->len = recvfrom(io->sock, pkt->data, IP_MAXPACKET, 0, &pkt->addr.sa, &pkt->addrlen)) < 0) ? -1 : 1;
+}
+
+static bool divertVerdict(PacketIO *io, Packet *pkt, bool pass)
+{
+   return !pass || sendto(io->sock, pkt->data, pkt->len, 0, &pkt->addr.sa, pkt->addrlen) >= 0;
+}
+
+static void divertClose(PacketIO *io)
+{
+   close(io->sock);
+}
+
+#endif
+
+
+typedef struct
+{
+   uint32_t magic;
+   uint16_t major, minor;
+   int32_t  zone;
+   uint32_t sigfigs;
+   uint32_t snaplen;
+   uint32_t linktype;
+} PcapHeader;
+
+static bool pcapOpen(PacketIO *io, char *arg)
+{
+   PcapHeader header;
+   char *outName = NULL;
+
+   if (!arg || !*arg)
+      return false;
+
+   for (char *a = arg; *a; a++)
+      if (*a == ',')
+      {
+         *a = '\0';
+         outName = a+1;
+         break;
+      }
+
+   if (!(io->in = fopen(arg, "r")) || fread(&header, sizeof(header), 1, io->in) != 1)
+      return false;
+
+   switch (header.magic)
+   {
+      case 0xA1B2C3D4:                    // microseconds
+      case 0xA1B23C4D:                    // nanoseconds
+         io->swapped = false;
+         break;
+
+      case 0xD4C3B2A1:
+      case 0x4D3CB2A1:
+         io->swapped = true;
+         break;
+
+      default:
+         errno = EINVAL;
+         return false;
+   }
+
+   switch (io->linktype = (io->swapped) ? swapInt32(header.linktype) : header.linktype)
+   {
+      case 0:                             // BSD loopback
+      case 1:                             // Ethernet
+      case 12: case 101: case 228:        // raw IP
+      case 108:                           // OpenBSD loopback
+      case 113:                           // Linux cooked capture
+         break;
+
+      default:
+         errno = EINVAL;
+         return false;
+   }
+
+   return !outName || (io->out = fopen(outName, "w")) && fwrite(&header, sizeof(header), 1, io->out) == 1;
+}
+
+static int pcapReceive(PacketIO *io, Packet *pkt)
+{
+   uint32_t record[4];                    // ts seconds, ts fraction, captured length, original length
+   uint32_t caplen;
+
+   for (;;)
+   {
+      if (fread(record, sizeof(record), 1, io->in) != 1)
+         return (feof(io->in)) ? 0 : -1;
+
+      caplen = (io->swapped) ? swapInt32(record[2]) : record[2];
+      if (caplen <= packetSize)
+         break;
+
+      // records which do not fit into a packet are skipped, by reading them through if the input is not seekable
+      if (fseek(io->in, caplen, SEEK_CUR) != 0)
+         for (uint32_t n; caplen; caplen -= n)
+            if (fread(pkt->data, n = (caplen < packetSize) ? caplen : packetSize, 1, io->in) != 1)
+            {
+               errno = EINVAL;
+               return -1;
+            }
+   }
+
+   // an empty record is passed as a packet without an IP header
+   if (caplen && fread(pkt->data, caplen, 1, io->in) != 1)
+   {
+      errno = EINVAL;
+      return -1;
+   }
+
+   pkt->len   = caplen;
+   pkt->ts[0] = record[0];
+   pkt->ts[1] = record[1];
+   pkt->addrlen = 0;
+
+   switch (io->linktype)
+   {
+      case 0:
+      case 108:
+         pkt->ip = 4;
+         break;
+
+      case 1:
+      {
+         int o = 12;                      // the ethertype, skipping any VLAN tags
+         while (o + 4 <= caplen && (pkt->data[o] == 0x81 || pkt->data[o] == 0x88) && (pkt->data[o+1] == 0x00 || pkt->data[o+1] == 0xA8))
+            o += 4;
+         pkt->ip = (o + 2 <= caplen && (pkt->data[o] == 0x08 && pkt->data[o+1] == 0x00 || pkt->data[o] == 0x86 && pkt->data[o+1] == 0xDD)) ? o + 2 : -1;
+         break;
+      }
+
+      case 113:
+         pkt->ip = 16;
+         break;
+
+      default:
+         pkt->ip = 0;
+         break;
+   }
+
+   if (pkt->ip >= caplen)
+      pkt->ip = -1;
+
+   return 1;
+}
+
+static bool pcapVerdict(PacketIO *io, Packet *pkt, bool pass)
+{
+   if (pass && io->out)
+   {
+      uint32_t record[4] = {pkt->ts[0], pkt->ts[1], (uint32_t)pkt->len, (uint32_t)pkt->len};
+      if (io->swapped)
+         record[2] = record[3] = swapInt32((uint32_t)pkt->len);
+      return fwrite(record, sizeof(record), 1, io->out) == 1 && (!pkt->len || fwrite(pkt->data, pkt->len, 1, io->out) == 1);
+   }
+
+   return true;
+}
+
+static void pcapClose(PacketIO *io)
+{
+   if (io->in)
+      fclose(io->in);
+   if (io->out)
+      fclose(io->out);
+}
+
+
+static bool unixOpen(PacketIO *io, char *arg)
+{
+   struct sockaddr_un address = {.sun_family = AF_UNIX};
+
+   if (!arg || !*arg || strvlen(arg) >= sizeof(address.sun_path))
+   {
+      errno = EINVAL;
+      return false;
+   }
+
+   strcpy(address.sun_path, arg);
+   unlink(arg);
+   if ((io->sock = socket(AF_UNIX, SOCK_DGRAM, 0)) < 0 || bind(io->sock, (struct sockaddr *)&address, sizeof(address)) < 0)
+      return false;
+
+   io->path = arg;
+   return true;
+}
+
+static int unixReceive(PacketIO *io, Packet *pkt)
+{
+   pkt->addrlen = sizeof(pkt->addr);
+   pkt->ip = 0;
+   return ((pkt->len = recvfrom(io->sock, pkt->data, IP_MAXPACKET, 0, &pkt->addr.sa, &pkt->addrlen)) < 0) ? -1 : 1;
+}
+
+static bool unixVerdict(PacketIO *io, Packet *pkt, bool pass)
+{
+   uint8_t verdict = pass;
+
+   // only senders, which are bound to a path, can receive the verdict
+   return pkt->addrlen <= offsetof(struct sockaddr_un, sun_path)
+       || sendto(io->sock, &verdict, 1, 0, &pkt->addr.sa, pkt->addrlen) >= 0;
+}
+
+static void unixClose(PacketIO *io)
+{
+   close(io->sock);
+   if (io->path)
+      unlink(io->path);
+}
+
+
+PacketIO backends[] =
+{
+#if defined(IPPROTO_DIVERT)
+   {"divert", divertOpen, divertReceive, divertVerdict, divertClose},
+#endif
+   {"pcap",   pcapOpen,   pcapReceive,   pcapVerdict,   pcapClose},
+   {"unix",   unixOpen,   unixReceive,   unixVerdict,   unixClose},
+   {NULL}
+};
+
+PacketIO *IO = NULL;
+
+void closeIO(void)
+{
+   if (IO)
+      IO->close(IO);
+}
+
+
+bool  allowMatch = true;
+bool  bitmapMode = false;
+bool  countryStats = false;
+int   cacheSize  = 4096;
+char *bstfname   = "/usr/local/etc/ipdb/IPRanges/ipcc.bst";
+
+LookupEngine ip4engine = bisectionEngine,
+             ip6engine = bisectionEngine;
+
+CCEntry *CCTable = NULL;
+
+
+// The policy, i.e. the compiled tables of the denied intervals, is read by the packet loop or the workers, and on SIGHUP
+// the reload thread compiles a new policy in the background and replaces the current one.
+
+typedef struct
+{
+   IP4Table   *ip4;
+   VerdictIP4 *verdict;
+   void       *verdictBlock;
+   IP6Table   *ip6;
+   IP4Table   *ip4cc;               // the IP ranges with the country codes, kept only for the statistics per country
+   IP6Table   *ip6cc;
+   uint32_t    generation;          // 1 .. 2^20-1, distinguishes the entries of the verdict caches from the ones of older policies
+} Policy;
+
+Policy *CurrentPolicy = NULL;
+
+void releasePolicy(Policy *policy)
+{
+   if (policy)
+   {
+      deallocate(VPR(policy->verdictBlock), false);
+      releaseIP4Table(policy->ip4);
+      releaseIP6Table(policy->ip6);
+      releaseIP4Table(policy->ip4cc);
+      releaseIP6Table(policy->ip6cc);
+      deallocate(VPR(policy), false);
+   }
+}
+
+// Compile the country list and the IP ranges into the tables of the denied intervals.
+Policy *loadPolicy(void)
+{
+   Policy   *policy;
+   IP4Table *IP4Store;
+   IP6Table *IP6Store;
+
+   int   namelen = strvlen(bstfname);
+   char *inName  = strcpy(alloca(namelen+4), bstfname);
+   *(uint32_t *)&inName[namelen] = *(uint32_t *)".v4";
+
+   static uint32_t generation = 0;
+
+   if (!(policy = allocate(sizeof(Policy), true)))
+      return NULL;
+
+   policy->generation = generation++ % 0xFFFFF + 1;
+
+   TableAccess access = (countryStats) ? residentAccess : sequentialAccess;
+
+   if (!(IP4Store = loadIP4Table(inName, bisectionEngine, access)))
+   {
+      syslog(LOG_ERR, "IPv4 database file could not be loaded.");
+      goto failed;
+   }
+
+   if (CCTable)
+      policy->ip4 = policyIP4Table(IP4Store, CCTable, allowMatch, ip4engine);
+
+   if (countryStats)
+      policy->ip4cc = IP4Store;
+   else
+      releaseIP4Table(IP4Store);
+
+   if (CCTable && !policy->ip4)
+   {
+      syslog(LOG_ERR, "The policy could not be compiled.");
+      goto failed;
+   }
+
+   if (policy->ip4)
+   {
+      syslog(LOG_INFO, "Policy compiled into %d denied IPv4 intervals.", policy->ip4->count);
+      if (policy->ip4->engine == learnedEngine)
+         syslog(LOG_INFO, "Learned index of the intervals in %d segments, max. error %d.",
+                ((LearnedIP4 *)policy->ip4->index)->segments, ((LearnedIP4 *)policy->ip4->index)->maxError);
+
+      if (bitmapMode)
+      {
+         struct timespec t0, t1;
+         clock_gettime(CLOCK_MONOTONIC, &t0);
+         if (!(policy->verdict = verdictIP4Bitmap(policy->ip4, &policy->verdictBlock)))
+         {
+            syslog(LOG_ERR, "The verdict bitmap could not be built.");
+            goto failed;
+         }
+         clock_gettime(CLOCK_MONOTONIC, &t1);
+
+         syslog(LOG_INFO, "Verdict bitmap of %zu kB with %d exceptions built in %.1f ms.",
+                (sizeof(VerdictIP4) + policy->verdict->count*sizeof(VerdictException))/1024, policy->verdict->count,
+                (t1.tv_sec - t0.tv_sec)*1e3 + (t1.tv_nsec - t0.tv_nsec)/1e6);
+      }
+   }
+
+   // the same for the IPv6 ranges
+   *(uint32_t *)&inName[namelen] = *(uint32_t *)".v6";
+   if (IP6Store = loadIP6Table(inName, bisectionEngine, access))
+   {
+      if (CCTable)
+         policy->ip6 = policyIP6Table(IP6Store, CCTable, allowMatch, ip6engine);
+
+      if (countryStats)
+         policy->ip6cc = IP6Store;
+      else
+         releaseIP6Table(IP6Store);
+
+      if (CCTable && !policy->ip6)
+      {
+         syslog(LOG_ERR, "The policy could not be compiled.");
+         goto failed;
+      }
+
+      if (policy->ip6)
+         syslog(LOG_INFO, "Policy compiled into %d denied IPv6 intervals.", policy->ip6->count);
+   }
+   else
+      syslog(LOG_ERR, "IPv6 database file could not be loaded, IPv6 packets pass unfiltered.");
+
+   return policy;
+
+failed:
+   releasePolicy(policy);
+   return NULL;
+}
+
+
+// Epoch based reclamation -- a reader announces the current epoch in its slot while it uses the policy, and it clears
+// the slot thereafter. Once the new policy is published, the epoch is advanced, and the old policy is released as soon
+// as no slot holds an older epoch, since only readers which entered before could still be using the old policy.
+// Slot 0 belongs to the single threaded packet loop, and the following ones to the workers.
+
+#define maxWorkers 64
+
+typedef struct
+{
+   _Alignas(64) uint64_t epoch;           // the epoch of the policy in use, or 0 if none
+} Reader;
+
+Reader   readers[maxWorkers + 1];
+uint64_t policyEpoch = 1;
+
+static inline Policy *enterPolicy(Reader *reader)
+{
+   __atomic_store_n(&reader->epoch, __atomic_load_n(&policyEpoch, __ATOMIC_ACQUIRE), __ATOMIC_SEQ_CST);
+   return __atomic_load_n(&CurrentPolicy, __ATOMIC_SEQ_CST);
+}
+
+static inline void leavePolicy(Reader *reader)
+{
+   __atomic_store_n(&reader->epoch, 0, __ATOMIC_RELEASE);
+}
+
+// Publish the new policy and release the old one, once all readers left it. If the readers do not leave it within
+// timeout ms, the old policy is not released -- a negative timeout waits indefinitely.
+bool replacePolicy(Policy *policy, int timeout)
+{
+   Policy  *old   = __atomic_exchange_n(&CurrentPolicy, policy, __ATOMIC_SEQ_CST);
+   uint64_t epoch = __atomic_add_fetch(&policyEpoch, 1, __ATOMIC_SEQ_CST), e;
+
+   for (int i = 0; i <= maxWorkers; i++)
+      while ((e = __atomic_load_n(&readers[i].epoch, __ATOMIC_SEQ_CST)) && e < epoch)
+         if (timeout-- == 0)
+            return false;
+         else
+            nanosleep(&(struct timespec){0, 1000000}, NULL);
+
+   releasePolicy(old);
+   return true;
+}
+
+pthread_mutex_t reloadLock = PTHREAD_MUTEX_INITIALIZER;
+
+// ipdb replaces the table files by rename(2), so loadPolicy() opens and maps the new inodes, while the mappings of the
+// old ones held by the current policy stay valid, and they are unmapped only by replacePolicy() after the swap.
+void reloadPolicy(void)
+{
+   Policy *policy;
+   struct timespec t0, t1;
+
+   syslog(LOG_INFO, "Received SIGHUP signal, reloading the IP ranges.");
+   clock_gettime(CLOCK_MONOTONIC, &t0);
+
+   pthread_mutex_lock(&reloadLock);
+   if (policy = loadPolicy())
+   {
+      replacePolicy(policy, -1);
+      clock_gettime(CLOCK_MONOTONIC, &t1);
+      syslog(LOG_INFO, "The IP ranges were reloaded in %.1f ms.", (t1.tv_sec - t0.tv_sec)*1e3 + (t1.tv_nsec - t0.tv_nsec)/1e6);
+   }
+   else
+      syslog(LOG_ERR, "The IP ranges could not be reloaded, the current ones stay in use.");
+   pthread_mutex_unlock(&reloadLock);
+}
+
+
+// Statistics -- the packet loop and each worker count the packets and the latencies of the classification into its
+// own cache line padded slot, with the same index as its reader slot, and on SIGUSR1 the slots are summed up and logged.
+// The latencies are counted in buckets of the powers of 2 of the ticks of the time stamp counter, if available.
+
+#define latencyBuckets 32
+
+// Verdict cache -- the traffic is dominated by a few thousand source addresses, and so each slot has a direct mapped
+// cache of the verdicts of the recent IPv4 sources, which spares the lookup in the policy tables. An entry holds the
+// generation of the policy, the country index + 2 and the verdict, and it is valid only for the current generation,
+// so that a reload invalidates all entries at once.
+
+typedef struct
+{
+   uint32_t ip;
+   uint32_t verdict;                      // generation << 12 | (country + 2) << 1 | pass
+} CacheEntry;
+
+typedef struct
+{
+   _Alignas(64) uint64_t passed;
+   uint64_t denied;
+   uint64_t notFound;                     // the source is not in the IP ranges -- counted only with -s
+   uint64_t latency[latencyBuckets];
+   uint64_t (*country)[2];                // the passed and denied packets per country, and 1 more for any other code -- only with -s
+   uint64_t cacheHits;
+   uint64_t cacheMisses;
+   CacheEntry *cache;                     // the verdict cache of the slot
+   void    *cacheBlock;                   // the allocated block of the aligned cache
+   int      cacheShift;
+} Stats;
+
+Stats  stats[maxWorkers + 1];
+double nsPerTick = 1.0;
+
+#define increment(counter) __atomic_store_n(&(counter), (counter) + 1, __ATOMIC_RELAXED)
+
+#if defined(__x86_64__)
+   #define ticks() __rdtsc()
+#else
+   static inline uint64_t ticks(void)
+   {
+      struct timespec ts;
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+      return ts.tv_sec*1000000000ULL + ts.tv_nsec;
+   }
+#endif
+
+void calibrateTicks(void)
+{
+#if defined(__x86_64__)
+   struct timespec t0, t1;
+   uint64_t r0, r1;
+
+   clock_gettime(CLOCK_MONOTONIC, &t0), r0 = ticks();
+   nanosleep(&(struct timespec){0, 20000000}, NULL);
+   clock_gettime(CLOCK_MONOTONIC, &t1), r1 = ticks();
+
+   if (r1 > r0)
+      nsPerTick = ((t1.tv_sec - t0.tv_sec)*1e9 + (t1.tv_nsec - t0.tv_nsec))/(r1 - r0);
+#endif
+}
+
+bool allocateStats(int slots)
+{
+   for (int i = 0; i < slots; i++)
+      if (!(stats[i].country = allocate((ccTableSize + 1)*sizeof(*stats[i].country), true)))
+         return false;
+
+   return true;
+}
+
+// The upper bound in ns of the latency bucket, which holds the given fraction of the packets.
+static double latencyQuantile(uint64_t *latency, uint64_t packets, double q)
+{
+   uint64_t sum = 0;
+   int      k;
+
+   for (k = 0; k < latencyBuckets - 1 && (sum += latency[k]) < q*packets; k++)
+      ;
+   return (2ULL << k)*nsPerTick;
+}
+
+void dumpStatistics(void)
+{
+   Stats    total = {0};
+   uint64_t country[ccTableSize + 1][2] = {{0}};
+   int      i, k;
+
+   for (i = 0; i <= maxWorkers; i++)
+   {
+      total.passed   += __atomic_load_n(&stats[i].passed, __ATOMIC_RELAXED);
+      total.denied   += __atomic_load_n(&stats[i].denied, __ATOMIC_RELAXED);
+      total.notFound += __atomic_load_n(&stats[i].notFound, __ATOMIC_RELAXED);
+      total.cacheHits   += __atomic_load_n(&stats[i].cacheHits, __ATOMIC_RELAXED);
+      total.cacheMisses += __atomic_load_n(&stats[i].cacheMisses, __ATOMIC_RELAXED);
+      for (k = 0; k < latencyBuckets; k++)
+         total.latency[k] += __atomic_load_n(&stats[i].latency[k], __ATOMIC_RELAXED);
+      if (stats[i].country)
+         for (k = 0; k <= ccTableSize; k++)
+         {
+            country[k][0] += __atomic_load_n(&stats[i].country[k][0], __ATOMIC_RELAXED);
+            country[k][1] += __atomic_load_n(&stats[i].country[k][1], __ATOMIC_RELAXED);
+         }
+   }
+
+   uint64_t packets = total.passed + total.denied;
+   if (countryStats)
+      syslog(LOG_INFO, "Statistics: %llu packets, %llu passed, %llu denied, %llu not found.",
+             (unsigned long long)packets, (unsigned long long)total.passed, (unsigned long long)total.denied, (unsigned long long)total.notFound);
+   else
+      syslog(LOG_INFO, "Statistics: %llu packets, %llu passed, %llu denied.",
+             (unsigned long long)packets, (unsigned long long)total.passed, (unsigned long long)total.denied);
+
+   if (packets == 0)
+      return;
+
+   syslog(LOG_INFO, "Latency of the classification: 50%% < %.0f ns, 99%% < %.0f ns, 99.9%% < %.0f ns, 100%% < %.0f ns.",
+          latencyQuantile(total.latency, packets, 0.5), latencyQuantile(total.latency, packets, 0.99),
+          latencyQuantile(total.latency, packets, 0.999), latencyQuantile(total.latency, packets, 1.0));
+   for (k = 0; k < latencyBuckets; k++)
+      if (total.latency[k])
+         syslog(LOG_INFO, "   < %9.0f ns: %llu", (2ULL << k)*nsPerTick, (unsigned long long)total.latency[k]);
+
+   uint64_t cached = total.cacheHits + total.cacheMisses;
+   if (cached)
+      syslog(LOG_INFO, "Verdict cache of %d entries (%zu kB per thread): %.1f %% hits of %llu IPv4 lookups.",
+             cacheSize, cacheSize*sizeof(CacheEntry)/1024, 100.0*total.cacheHits/cached, (unsigned long long)cached);
+
+   for (k = 0; k <= ccTableSize; k++)
+      if (country[k][0] || country[k][1])
+         syslog(LOG_INFO, "Country %c%c: %llu passed, %llu denied.", (k < ccTableSize) ? 'A' + k/26 : '?', (k < ccTableSize) ? 'A' + k%26 : '?',
+                (unsigned long long)country[k][0], (unsigned long long)country[k][1]);
+}
+
+
+static void *controller(void *arg)
+{
+   char c;
+
+   for (;;)
+      if (read(controlPipe[0], &c, 1) == 1)
+         switch (c)
+         {
+            case 'H':
+               reloadPolicy();
+               break;
+
+            case 'U':
+               dumpStatistics();
+               break;
+         }
+
+      else if (errno != EINTR)
+         return NULL;
+}
+
+
+#define noCountry   -2
+#define notInRanges -1
+
+
+bool allocateCaches(int slots)
+{
+   for (int i = 0; i < slots; i++)
+   {
+      if (!(stats[i].cache = allocateAligned(cacheSize*sizeof(CacheEntry), &stats[i].cacheBlock)))
+         return false;
+
+      stats[i].cacheShift = 32 - __builtin_ctz(cacheSize);
+   }
+
+   return true;
+}
+
+void releaseCaches(void)
+{
+   for (int i = 0; i <= maxWorkers; i++)
+   {
+      stats[i].cache = NULL;
+      deallocate(VPR(stats[i].cacheBlock), false);
+   }
+}
+
+static inline bool passIP4(uint32_t src, Policy *policy, int *country)
+{
+   if (country)
+   {
+      int i = tableIP4Search(src, policy->ip4cc);
+      *country = (i >= 0) ? cci(policy->ip4cc->sets[i][2]) : notInRanges;
+   }
+
+   if (policy->verdict)
+      return !verdictIP4Denied(src, policy->verdict, policy->ip4->sets);
+   else
+      return !policy->ip4 || tableIP4Search(src, policy->ip4) < 0;
+}
+
+static inline bool cachedPassIP4(uint32_t src, Policy *policy, Stats *st, int *country)
+{
+   CacheEntry *entry = &st->cache[(src*2654435761U) >> st->cacheShift];
+   bool        pass;
+
+   if (entry->ip == src && entry->verdict >> 12 == policy->generation)
+   {
+      increment(st->cacheHits);
+      if (country)
+         *country = (int)(entry->verdict >> 1 & 0x7FF) - 2;
+      return entry->verdict & 1;
+   }
+
+   increment(st->cacheMisses);
+   pass = passIP4(src, policy, country);
+   *entry = (CacheEntry){src, policy->generation << 12 | ((country) ? *country + 2 : 0) << 1 | pass};
+   return pass;
+}
+
+
+// If country is not NULL, then it receives the index of the country of the source, or notInRanges.
+static inline bool passPacket(Packet *pkt, Policy *policy, Stats *st, int *country)
+{
+   if (pkt->ip < 0 || !policy)
+      return true;
+
+   // deny the packet if its source IP is in a denied interval -- nothing is denied if no CC list was given,
+   // and packets of other protocols and truncated ones pass
+   switch (pkt->data[pkt->ip] >> 4)
+   {
+      case 4:
+      {
+         uint32_t src;
+         if (pkt->len - pkt->ip < sizeof(struct ip))
+            return true;
+
+         memcpy(&src, &pkt->data[pkt->ip + offsetof(struct ip, ip_src)], sizeof(uint32_t));
+         src = ntohl(src);
+
+         return (st->cache) ? cachedPassIP4(src, policy, st, country) : passIP4(src, policy, country);
+      }
+
+      case 6:
+      {
+         uint64_t src[2];
+         if (pkt->len - pkt->ip < sizeof(struct ip6_hdr))
+            return true;
+
+         memcpy(src, &pkt->data[pkt->ip + offsetof(struct ip6_hdr, ip6_src)], sizeof(src));
+         uint128t ip6 = (IP6Desc){swapInt64(src[b2_1]), swapInt64(src[b2_0])}.number;
+
+         if (country && policy->ip6cc)
+         {
+            uint32_t cc;
+            int i = tableIP6Search(ip6, policy->ip6cc);
+            if (i >= 0)
+               memcpy(&cc, &policy->ip6cc->sets[i][2], sizeof(uint32_t));
+            *country = (i >= 0) ? cci(cc) : notInRanges;
+         }
+
+         return !policy->ip6 || tableIP6Search(ip6, policy->ip6) < 0;
+      }
+
+      default:
+         return true;
+   }
+}
+
+// Classify the packet by the current policy, and count it in the given reader and statistics slot.
+static inline void classifyPacket(Packet *pkt, int slot)
+{
+   Stats   *st = &stats[slot];
+   int      country = noCountry;
+   uint64_t t = ticks();
+
+   pkt->pass = passPacket(pkt, enterPolicy(&readers[slot]), st, (st->country) ? &country : NULL);
+   leavePolicy(&readers[slot]);
+
+   t = ticks() - t;
+   increment(st->latency[(t > 1) ? ((t >> latencyBuckets) ? latencyBuckets - 1 : 63 - __builtin_clzll(t)) : 0]);
 
-CCNode **CCTable = NULL;
-IP4Set  *sortedIP4Sets = NULL;
+   if (pkt->pass)
+      increment(st->passed);
+   else
+      increment(st->denied);
+
+   if (country >= 0)
+      increment(st->country[country][!pkt->pass]);
+   else if (country == notInRanges)
+      increment(st->notFound);
+}
 
 void releaseStores(void)
 {
-   deallocate(VPR(sortedIP4Sets), false);
-   releaseCCTable(CCTable);
+   // a reload in progress, e.g. if the signal to exit interrupted the reload thread, keeps the stores
+   if (pthread_mutex_trylock(&reloadLock) == 0)
+   {
+      // the readers use the verdict caches only with a policy, and so they are done with them, once they left it
+      if (replacePolicy(NULL, 100))
+         releaseCaches();
+      releaseCCTable(CCTable);
+      CCTable = NULL;
+   }
+}
+
+int64_t passedPackets = 0,
+        deniedPackets = 0;
+
+static inline void returnPacket(Packet *pkt)
+{
+   if (pkt->pass)
+      passedPackets++;
+   else
+      deniedPackets++;
+
+   if (!IO->verdict(IO, pkt, pkt->pass))
+   {
+      syslog(LOG_ERR, "Error returning the packet to the %s packet I/O: %d", IO->name, errno);
+      exit(EXIT_FAILURE);
+   }
 }
 
+// Receive, classify and return the packets in a single thread.
+int packetLoop(void)
+{
+   int rc;
+   Packet *pkt = allocate(sizeof(Packet), false);
+
+   while ((rc = IO->receive(IO, pkt)) > 0)
+   {
+      classifyPacket(pkt, 0);
+      returnPacket(pkt);
+   }
+
+   deallocate(VPR(pkt), false);
+   return rc;
+}
+
+
+// Worker pool -- the receiver hands the packets round robin over to the workers, and the sender takes the classified
+// packets round robin back from the workers, so their order is kept. The packets pass lock-free single producer/single
+// consumer rings, and the sender returns the packet buffers to the receiver through the free ring. The rings are larger
+// than the pool of packets, so pushing never fails.
+
+#define ringSize   512
+#define poolSize   256
+
+typedef struct
+{
+   _Alignas(64) uint32_t head;            // next slot to be popped, written by the consumer only
+   _Alignas(64) uint32_t tail;            // next slot to be pushed, written by the producer only
+   _Alignas(64) Packet  *slots[ringSize];
+} Ring;
+
+static inline void ringPush(Ring *ring, Packet *pkt)
+{
+   uint32_t tail = ring->tail;
+   ring->slots[tail & (ringSize - 1)] = pkt;
+   __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+static inline Packet *ringPop(Ring *ring)
+{
+   uint32_t head = ring->head;
+   if (head == __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE))
+      return NULL;
+
+   Packet *pkt = ring->slots[head & (ringSize - 1)];
+   __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+   return pkt;
+}
+
+#if defined(__x86_64__)
+   #define cpuRelax() _mm_pause()
+#else
+   #define cpuRelax()
+#endif
+
+// Back off from spinning to yielding to sleeping, while a ring stays empty.
+static inline void ringWait(int *idle)
+{
+   if (++*idle < 64)
+      cpuRelax();
+   else if (*idle < 128)
+      sched_yield();
+   else
+      nanosleep(&(struct timespec){0, 50000}, NULL);
+}
+
+typedef struct
+{
+   Ring      in, out;
+   pthread_t thread;
+   int       cpu;
+} Worker;
+
+Worker  workers[maxWorkers];
+Ring    freeRing;
+int     workerCount = 0;
+int     cpuCount    = 0;
+int     cpus[maxWorkers + 2];
+
+static uint8_t endMark;
+#define endOfInput ((Packet *)&endMark)
+
+static void pinThread(int i)
+{
+   if (cpuCount)
+   {
+#if defined(__linux__) || defined(__FreeBSD__)
+      cpu_set_t set;
+      CPU_ZERO(&set);
+      CPU_SET(cpus[i % cpuCount], &set);
+      if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+         syslog(LOG_ERR, "Error pinning thread %d to CPU %d.", i, cpus[i % cpuCount]);
+#else
+      if (i == 0)
+         syslog(LOG_ERR, "Pinning threads to CPUs is not supported on this system.");
+#endif
+   }
+}
+
+static void *worker(void *arg)
+{
+   Worker *w = arg;
+   Packet *pkt;
+
+   pinThread(w->cpu);
+   for (int idle = 0;;)
+      if (pkt = ringPop(&w->in))
+      {
+         idle = 0;
+         if (pkt == endOfInput)
+         {
+            ringPush(&w->out, pkt);
+            return NULL;
+         }
+
+         classifyPacket(pkt, w - workers + 1);
+         ringPush(&w->out, pkt);
+      }
+      else
+         ringWait(&idle);
+}
+
+static void *sender(void *arg)
+{
+   Packet *pkt;
+   int     w = 0, ends = 0;
+
+   pinThread(1);
+   for (int idle = 0; ends < workerCount;)
+      if (pkt = ringPop(&workers[w].out))
+      {
+         idle = 0;
+         if (pkt == endOfInput)
+            ends++;
+         else
+         {
+            returnPacket(pkt);
+            ringPush(&freeRing, pkt);
+         }
+         w = (w + 1) % workerCount;
+      }
+      else
+         ringWait(&idle);
+
+   return NULL;
+}
+
+int workerPool(void)
+{
+   int       i, w, rc;
+   pthread_t senderThread;
+   Packet   *pkt, *pool = allocate(poolSize*sizeof(Packet), false);
+
+   if (!pool)
+      return -1;
+
+   for (i = 0; i < poolSize; i++)
+      ringPush(&freeRing, &pool[i]);
+
+   pinThread(0);
+   for (w = 0; w < workerCount; w++)
+   {
+      workers[w].cpu = w + 2;
+      if (pthread_create(&workers[w].thread, NULL, worker, &workers[w]) != 0)
+         return -1;
+   }
+   if (pthread_create(&senderThread, NULL, sender, NULL) != 0)
+      return -1;
+
+   for (w = 0, i = 0;; w = (w + 1) % workerCount)
+   {
+      while (!(pkt = ringPop(&freeRing)))
+         ringWait(&i);
+      i = 0;
+
+      if ((rc = IO->receive(IO, pkt)) <= 0)
+         break;
+
+      ringPush(&workers[w].in, pkt);
+   }
+
+   if (rc < 0)
+      return rc;
+
+   // end of input, the workers take the end marks in the same round robin order as the packets
+   for (i = 0; i < workerCount; i++)
+      ringPush(&workers[(w + i) % workerCount].in, endOfInput);
+
+   for (w = 0; w < workerCount; w++)
+      pthread_join(workers[w].thread, NULL);
+   pthread_join(senderThread, NULL);
+
+   deallocate(VPR(pool), false);
+   return 0;
+}
+
+
 int main(int argc, char *argv[])
 {
    int   ch, rc     = 0;
    char *cmd        = argv[0];
    char *allowList  = NULL,
         *denyList   = NULL,
-        *bstfname   = "/usr/local/etc/ipdb/IPRanges/ipcc.bst";
+        *ioArg      = NULL;
+   const char *ioName = "divert";
    DaemonKind dKind = discreteDaemon;
 
-   while ((ch = getopt(argc, argv, "a:d:r:p:fnh")) != -1)
+   while ((ch = getopt(argc, argv, "a:d:e:bi:w:c:sv:r:p:fnh")) != -1)
    {
       switch (ch)
       {
@@ -228,6 +1272,47 @@ int main(int argc, char *argv[])
                goto arg_err;
             break;
 
+         case 'e':
+            if (!parseLookupEngines(optarg, &ip4engine, &ip6engine))
+               goto arg_err;
+            break;
+
+         case 'b':
+            bitmapMode = true;
+            break;
+
+         case 'i':
+            ioName = optarg;
+            if (ioArg = strchr(optarg, ':'))
+               *ioArg++ = '\0';
+            break;
+
+         case 'w':
+            if ((workerCount = (int)strtol(optarg, NULL, 10)) < 0 || maxWorkers < workerCount)
+               goto arg_err;
+            break;
+
+         case 'c':
+         {
+            char *c = optarg, *e;
+            for (cpuCount = 0; *c && cpuCount < maxWorkers + 2; cpuCount++, c = (*e == ',') ? e+1 : e)
+               if ((cpus[cpuCount] = (int)strtol(c, &e, 10)) < 0 || e == c)
+                  goto arg_err;
+            if (*c)
+               goto arg_err;
+            break;
+         }
+
+         case 's':
+            countryStats = true;
+            break;
+
+         case 'v':
+            if ((cacheSize = (int)strtol(optarg, NULL, 10)) != 0
+             && (cacheSize < 64 || cacheSize > 16777216 || (cacheSize & (cacheSize - 1))))
+               goto arg_err;
+            break;
+
          case 'r':
             bstfname = optarg;
             break;
@@ -264,6 +1349,16 @@ int main(int argc, char *argv[])
       return 1;
    }
 
+   for (IO = backends; IO->name && strcmp(IO->name, ioName) != 0; IO++)
+      ;
+   if (!IO->name)
+   {
+      IO = NULL;
+      printf("Unknown or unavailable packet I/O backend: %s\n\n", ioName);
+      usage(cmd);
+      return 1;
+   }
+
    daemonize(dKind);
 
    char *cc = (allowList) ?: denyList;
@@ -281,67 +1376,53 @@ int main(int argc, char *argv[])
       }
    }
 
-   struct stat st;
-   FILE *in;
-   if (stat(bstfname, &st) == noerr && st.st_size && (in = fopen(bstfname, "r")))
+   calibrateTicks();
+   if (countryStats && !allocateStats(workerCount + 1))
+   {
+      syslog(LOG_ERR, "The country statistics could not be allocated.");
+      exit(EXIT_FAILURE);
+   }
+
+   if (cacheSize && !allocateCaches(workerCount + 1))
+   {
+      syslog(LOG_ERR, "The verdict caches could not be allocated.");
+      exit(EXIT_FAILURE);
+   }
+
+   if (CurrentPolicy = loadPolicy())
    {
-      sortedIP4Sets = allocate((ssize_t)st.st_size, false);
       atexit(releaseStores);
-      rc = (int)fread(sortedIP4Sets, (ssize_t)st.st_size, 1, in);
-      fclose(in);
-      if (!rc)
-      {
-         syslog(LOG_ERR, "IPv4 database file could not be loaded.");
-         exit(EXIT_FAILURE);
-      }
 
-      int divertSock;
-      if ((divertSock = socket(PF_INET, SOCK_RAW, IPPROTO_DIVERT)) < 0)
+      pthread_t controlThread;
+      if (pipe(controlPipe) != 0 || pthread_create(&controlThread, NULL, controller, NULL) != 0)
       {
-         syslog(LOG_ERR, "Error creating the divert socket: %d", errno);
+         syslog(LOG_ERR, "Error creating the control thread: %d", errno);
          exit(EXIT_FAILURE);
       }
 
-      struct sockaddr_in divertAddress = {};
-      divertAddress.sin_family = AF_INET;
-      divertAddress.sin_port = htons(8669);
-      if (bind(divertSock, (struct sockaddr *)&divertAddress, sizeof(divertAddress)) < 0)
+      if (!IO->open(IO, ioArg))
       {
-         syslog(LOG_ERR, "Error calling bind() on the divert socket: %d", errno);
+         syslog(LOG_ERR, "Error opening the %s packet I/O: %d", IO->name, errno);
          exit(EXIT_FAILURE);
       }
+      atexit(closeIO);
 
-      uint8_t buffer[IP_MAXPACKET];
-      struct ip *ip = (struct ip*)buffer;
-      struct sockaddr_in addr;
-      socklen_t addrlen = sizeof(addr);
-      ssize_t recvlen, sendlen;
-
-      int o, n = (int)(st.st_size/sizeof(IP4Set));
+      struct timespec t0, t1;
+      clock_gettime(CLOCK_MONOTONIC, &t0);
 
-      for (;;)
+      if ((rc = (workerCount) ? workerPool() : packetLoop()) < 0)
       {
-         if ((recvlen = recvfrom(divertSock, buffer, IP_MAXPACKET, 0, (struct sockaddr *)&addr, &addrlen)) < 0)
-         {
-            syslog(LOG_ERR, "Error receiving raw data from the divert socket: %d", errno);
-            exit(EXIT_FAILURE);
-         }
-
-         // don't filter if no CC list was given or if the source IP cannot be found in the IP ranges sets
-         if (CCTable && (o = bisectionIP4Search(htonl(ip->ip_src.s_addr), sortedIP4Sets, n)) >= 0)
-         {
-            bool doesMatch = findCC(CCTable, sortedIP4Sets[o][2]) != NULL;
-            if (allowMatch && !doesMatch || !allowMatch && doesMatch)
-               continue;
-         }
-
-         if ((sendlen = sendto(divertSock, buffer, recvlen, 0, (struct sockaddr *)&addr, sizeof(addr))) < 0)
-         {
-            syslog(LOG_ERR, "Error sending raw data to the divert socket: %d", errno);
-            exit(EXIT_FAILURE);
-         }
+         syslog(LOG_ERR, "Error receiving a packet from the %s packet I/O: %d", IO->name, errno);
+         exit(EXIT_FAILURE);
       }
 
+      // end of input, e.g. of a pcap file
+      clock_gettime(CLOCK_MONOTONIC, &t1);
+      dumpStatistics();
+      double t = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec)/1e9;
+      int64_t packets = passedPackets + deniedPackets;
+      syslog(LOG_INFO, "%lld packets, %lld passed, %lld denied, in %.3f s, %.0f packets/s.",
+             (long long)packets, (long long)passedPackets, (long long)deniedPackets, t, (t > 0) ? packets/t : 0.0);
       return 0;
    }
 
@@ -141,9 +141,28 @@ else
    exit 1
 fi
 
-/usr/local/bin/ipdb "$IPRanges/ipcc.bst" \
-                    "$IPRanges/afrinic.dat" \
-                    "$IPRanges/apnic.dat" \
-                    "$IPRanges/arin.dat" \
-                    "$IPRanges/lacnic.dat" \
-                    "$IPRanges/ripencc.dat"
+# keep the previous tables as ipcc.bst.prev.v4/v6 for incremental firewall updates by ipup -d,
+# since ipdb replaces the tables by rename(2), the hard links keep referring to the previous ones
+for ext in v4 v6; do
+   if [ -f "$IPRanges/ipcc.bst.$ext" ]; then
+      /bin/ln -f "$IPRanges/ipcc.bst.$ext" "$IPRanges/ipcc.bst.prev.$ext"
+   else
+      /bin/rm -f "$IPRanges/ipcc.bst.prev.$ext"
+   fi
+done
+
+# ipdb replaces the tables by rename(2) only after it has written them completely,
+# and if it fails, the previous tables stay in place and geod is not signaled
+if ! /usr/local/bin/ipdb "$IPRanges/ipcc.bst" \
+                        "$IPRanges/afrinic.dat" \
+                        "$IPRanges/apnic.dat" \
+                        "$IPRanges/arin.dat" \
+                        "$IPRanges/lacnic.dat" \
+                        "$IPRanges/ripencc.dat"; then
+   exit 1
+fi
+
+if [ -f "/var/run/geod.pid" ]; then
+   # make a running geod daemon reload the updated IP ranges
+   /bin/kill -HUP `/bin/cat "/var/run/geod.pid"`
+fi
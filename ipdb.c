@@ -30,6 +30,7 @@
 #include <stdint.h>
 #include <math.h>
 #include <string.h>
+#include <unistd.h>
 #include <sys/stat.h>
 #include <sys/time.h>
 
@@ -37,8 +38,50 @@
 #include "store.h"
 
 
-IP4Node *IP4Store = NULL;
-IP6Node *IP6Store = NULL;
+// The parsed records are appended to flat arrays, which are consolidated after reading all RIR files by a sort
+// and sweep, instead of merging each record into the AVL trees.
+
+IP4Record *IP4Records = NULL;
+IP6Record *IP6Records = NULL;
+int        IP4Count = 0, IP4Size = 0,
+           IP6Count = 0, IP6Size = 0;
+uint32_t   sequence = 0;
+
+static bool appendIP4Record(uint32_t lo, uint32_t hi, uint32_t cc)
+{
+   if (IP4Count == IP4Size)
+   {
+      int        size    = (IP4Size) ? 2*IP4Size : 65536;
+      IP4Record *records = reallocate(IP4Records, size*sizeof(IP4Record), false, false);
+      if (!records)
+         return false;
+
+      IP4Records = records;
+      IP4Size    = size;
+   }
+
+   IP4Records[IP4Count++] = (IP4Record){lo, hi, cc, sequence++};
+   return true;
+}
+
+static bool appendIP6Record(uint128t lo, uint128t hi, uint32_t cc)
+{
+   if (IP6Count == IP6Size)
+   {
+      int        size    = (IP6Size) ? 2*IP6Size : 65536;
+      IP6Record *records = reallocate(IP6Records, size*sizeof(IP6Record), false, false);
+      if (!records)
+         return false;
+
+      IP6Records = records;
+      IP6Size    = size;
+   }
+
+   IP6Records[IP6Count++] = (IP6Record){lo, hi, cc, sequence++};
+   return true;
+}
+
+// Returns the number of the records, -1 for an unsupported data format, or -2 if there is not enough memory.
 
 int readRIRStatisticsFormat_v2(FILE *in, size_t totalsize)
 {
@@ -101,7 +144,6 @@ int readRIRStatisticsFormat_v2(FILE *in, size_t totalsize)
                if (fl)
                   if (*(uint32_t*)iv == *(uint32_t*)"ipv4")
                   {
-                     IP4Node *node;
                      uint32_t iplo, iphi;
 
                      uppercase(cc, fl);
@@ -116,25 +158,18 @@ int readRIRStatisticsFormat_v2(FILE *in, size_t totalsize)
                            char *ct = ip+fl+1;
                            iphi = iplo + (uint32_t)strtoul(ct, NULL, 10) - 1;
 
-                           while (node = findNet4Node(iplo, iphi, *(uint16_t*)cc, IP4Store))
+                           if (!appendIP4Record(iplo, iphi, *(uint16_t*)cc))
                            {
-                              if (node->lo < iplo)
-                                 iplo = node->lo;
-
-                              if (node->hi > iphi)
-                                 iphi = node->hi;
-
-                              removeIP4Node(node->lo, &IP4Store); count--;
+                              count = -2;
+                              goto quit;
                            }
-
-                           addIP4Node(iplo, iphi, *(uint16_t*)cc, &IP4Store); count++;
+                           count++;
                         }
                      }
                   }
 
                   else if (*(uint32_t*)iv == *(uint32_t*)"ipv6")
                   {
-                     IP6Node *node;
                      uint128t iplo, iphi;
 
                      uppercase(cc, fl);
@@ -149,18 +184,12 @@ int readRIRStatisticsFormat_v2(FILE *in, size_t totalsize)
                            char *pfx = ip+fl+1;
                            iphi = add_u128(iplo, inteb6_m1(128 - (int32_t)strtoul(pfx, NULL, 10)));
 
-                           while (node = findNet6Node(iplo, iphi, *(uint16_t*)cc, IP6Store))
+                           if (!appendIP6Record(iplo, iphi, *(uint16_t*)cc))
                            {
-                              if (lt_u128(node->lo, iplo))
-                                 iplo = node->lo;
-
-                              if (gt_u128(node->hi, iphi))
-                                 iphi = node->hi;
-
-                              removeIP6Node(node->lo, &IP6Store); count--;
+                              count = -2;
+                              goto quit;
                            }
-
-                           addIP6Node(iplo, iphi, *(uint16_t*)cc, &IP6Store); count++;
+                           count++;
                         }
                      }
                   }
@@ -177,6 +206,28 @@ quit:
 }
 
 
+// The tables are written to temporary files, which replace the previous tables by rename(2) only after both were
+// completely written and synced, so that any process which maps the previous tables keeps reading their inodes until
+// it maps the new ones, and a failed run leaves the previous tables untouched.
+static bool writeTemporary(const char *tmpName, const void *sets, size_t size, int count)
+{
+   FILE *out;
+   bool  ok;
+
+   if (!(out = fopen(tmpName, "w")))
+      return false;
+
+   ok = fwrite(sets, size, count, out) == count && fflush(out) == 0 && fsync(fileno(out)) == 0;
+   if (fclose(out) != 0 || !ok)
+   {
+      unlink(tmpName);
+      return false;
+   }
+
+   return true;
+}
+
+
 int main(int argc, const char *argv[])
 {
    if (argc >= 3)
@@ -184,56 +235,81 @@ int main(int argc, const char *argv[])
       int   namelen = strvlen(argv[1]);
       char *out4Name = strcpy(alloca(namelen+4), argv[1]); *(uint32_t *)&out4Name[namelen] = *(uint32_t *)".v4";
       char *out6Name = strcpy(alloca(namelen+4), argv[1]); *(uint32_t *)&out6Name[namelen] = *(uint32_t *)".v6";
-      FILE *out4, *out6;
+      char *tmp4Name = strcat(strcpy(alloca(namelen+8), out4Name), ".tmp");
+      char *tmp6Name = strcat(strcpy(alloca(namelen+8), out6Name), ".tmp");
 
-      if (out4 = fopen(out4Name, "w"))
-         if (out6 = fopen(out6Name, "w"))
-         {
-            int    count = 0;
-            FILE  *in;
-            struct stat st;
+      int    count = 0;
+      FILE  *in;
+      struct stat st;
 
-            printf("ipdb v1.1.1 ("SVNREV"), Copyright © 2016 Dr. Rolf Jansen\nProcessing RIR data files ...\n\n");
-            for (int inc = 2; inc < argc; inc++)
+      printf("ipdb v1.1.1 ("SVNREV"), Copyright © 2016 Dr. Rolf Jansen\nProcessing RIR data files ...\n\n");
+      for (int inc = 2; inc < argc; inc++)
+      {
+         if (stat(argv[inc], &st) == noerr && st.st_size && (in = fopen(argv[inc], "r")))
+         {
+            const char *file = strrchr(argv[inc], '/');
+            if (file)
+               file++;
+            else
+               file = argv[inc];
+            printf(" %s ", file);
+            fflush(stdout);
+
+            int records = readRIRStatisticsFormat_v2(in, (size_t)st.st_size);
+            fclose(in);
+
+            if (records == -2)
             {
-               if (stat(argv[inc], &st) == noerr && st.st_size && (in = fopen(argv[inc], "r")))
-               {
-                  const char *file = strrchr(argv[inc], '/');
-                  if (file)
-                     file++;
-                  else
-                     file = argv[inc];
-                  printf(" %s ", file);
-                  fflush(stdout);
+               printf("\n\nNot enough memory.\n");
+               return 1;
+            }
+            else if (records < 0)
+               count += records;
+         }
 
-                  count += readRIRStatisticsFormat_v2(in, (size_t)st.st_size);
+         else
+         {
+            printf("\n");
+            return 1;
+         }
+      }
 
-                  fclose(in);
-               }
+      IP4Set *sets4 = allocate(IP4Count*sizeof(IP4Set), false);
+      IP6Set *sets6 = allocate(IP6Count*sizeof(IP6Set), false);
+      int     n4, n6;
+      bool    sorted  = sets4 && sets6
+                     && (n4 = sweepIP4Records(IP4Records, IP4Count, sets4)) >= 0
+                     && (n6 = sweepIP6Records(IP6Records, IP6Count, sets6)) >= 0,
+              written = false;
 
-               else
-               {
-                  fclose(out6);
-                  fclose(out4);
-                  printf("\n");
-                  return 1;
-               }
-            }
+      if (sorted)
+      {
+         if (writeTemporary(tmp4Name, sets4, sizeof(IP4Set), n4))
+            if (writeTemporary(tmp6Name, sets6, sizeof(IP6Set), n6))
+               written = true;
+            else
+               unlink(tmp4Name);
 
-            serializeIP4Tree(out4, IP4Store);
-            releaseIP4Tree(IP4Store);
+         count += n4 + n6;
+      }
 
-            serializeIP6Tree(out6, IP6Store);
-            releaseIP6Tree(IP6Store);
+      deallocate_batch(false, VPR(sets6), VPR(sets4), VPR(IP6Records), VPR(IP4Records), NULL);
 
-            fclose(out6);
-            fclose(out4);
+      if (!sorted)
+      {
+         printf("\n\nNot enough memory.\n");
+         return 1;
+      }
 
-            printf("\n\nNumber of processed IP-Ranges = %d\n", count);
-            return 0;
-         }
-         else
-            fclose(out4);
+      if (!written || rename(tmp4Name, out4Name) != 0 || rename(tmp6Name, out6Name) != 0)
+      {
+         unlink(tmp6Name);
+         printf("\n\nThe IP-Ranges tables could not be written.\n");
+         return 1;
+      }
+
+      printf("\n\nNumber of processed IP-Ranges = %d\n", count);
+      return 0;
    }
 
    return 1;
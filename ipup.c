@@ -32,8 +32,21 @@
 #include <errno.h>
 #include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/time.h>
+#include <sys/un.h>
+
+#if defined(__linux__)
+   #include <sys/epoll.h>
+#else
+   #include <sys/event.h>
+#endif
 
 #include "binutils.h"
 #include "store.h"
@@ -46,11 +59,19 @@ void usage(const char *executable)
    printf("%s v1.1.1 ("SVNREV"), Copyright © 2016 Dr. Rolf Jansen\n\n", r);
    printf("Usage:\n\n");
    printf("1) look up the country code belonging to an IP address given by the last command line argument:\n\n");
-   printf("   %s [-r bstfiles] [-h] <IP address>\n", r);
-   printf("      <IP address>      IPv4 or IPv6 address of which the country code is to be looked up.\n\n");
+   printf("   %s [-e engine] [-r bstfiles] [-h] <IP address>\n", r);
+   printf("      <IP address>      IPv4 or IPv6 address of which the country code is to be looked up.\n");
+   printf("      -e engine         The lookup engine [default: bisection], either one for both IP versions,\n");
+   printf("         | v4eng:v6eng  or one per IP version separated by colon:\n");
+   printf("                        bisection - binary search in the sorted table.\n");
+   printf("                        eytzinger - branchless search in the Eytzinger layout of the sorted table.\n");
+   printf("                        stree     - SIMD search in a static 16-ary B-tree (IPv4 only).\n");
+   printf("                        dir16 .. dir24 - direct indexed table of 2^16 up to 2^24 slots (IPv4 only).\n");
+   printf("                        learned   - piecewise linear model of the positions in the sorted table (IPv4 only).\n");
+   printf("                        poptrie   - compressed multibit trie with a 2^20 slots direct table (IPv6 only).\n\n");
    printf("      -h                Show these usage instructions.\n\n");
    printf("2) generate a sorted list of IP address/masklen pairs per country code, formatted as ipfw table construction directives:\n\n");
-   printf("   %s -t CC:DD:.. | CC=nnnnn:DD=mmmmm:.. | \"\" [-n table number] [-v table value] [-x offset] [-p] [-4] [-6] [-r bstfiles]\n\n", r);
+   printf("   %s -t CC:DD:.. | CC=nnnnn:DD=mmmmm:.. | \"\" [-n table number] [-v table value] [-x offset] [-p] [-a] [-4] [-6] [-w workers] [-d oldbstfiles] [-r bstfiles]\n\n", r);
    printf("      -t CC:DD:..       Output all IP address/masklen pairs belonging to the listed countries, given by 2 letter\n");
    printf("         | CC=nnnnn:..  capital country codes, separated by colon. An empty CC list means any country code.\n");
    printf("           | \"\"         A table value can be assigned per country code in the following manner:\n");
@@ -62,18 +83,39 @@ void usage(const char *executable)
    printf("                        value = offset + ((C1 - 'A')*26 + (C2 - 'A'))*10.\n");
    printf("      -p                Plain IP table generation, i.e. without ipfw table construction directives,\n");
    printf("                        and any -n, -v and -x flags are ignored in this mode.\n");
+   printf("      -a                Aggregate the touching ranges with the same table value, e.g. of different countries\n");
+   printf("                        with -v or -p, and output the minimal set of address/masklen pairs covering them.\n");
    printf("      -4                Process only the IPv4 address ranges.\n");
-   printf("      -6                process only the IPv6 address ranges.\n\n");
+   printf("      -6                process only the IPv6 address ranges.\n");
+   printf("      -w workers        The number of threads between 1 and 64 for formatting the table entries, which are\n");
+   printf("                        output in the same order as by one thread [default: the number of CPUs].\n");
+   printf("      -d oldbstfiles    Difference mode, output only the directives for deleting the pairs of the previous\n");
+   printf("                        tables at the given base path which vanished or changed their value, and for adding\n");
+   printf("                        the new or changed pairs of the current tables. With -p, the pairs are prefixed by\n");
+   printf("                        'delete' or 'add'.\n\n");
    printf("   valid argument in usage forms 1+2:\n\n");
    printf("      -r bstfiles       Base path to the binary sorted tables (.v4 and .v6) with the consolidated IP ranges\n");
    printf("                        which were generated by the 'ipdb' tool [default: /usr/local/etc/ipdb/IPRanges/ipcc.bst].\n\n");
    printf("3) compute the encoded value of a country code (see -x flag above):\n\n");
    printf("   %s -q CC\n", r);
    printf("      -q CC             The country code to be encoded.\n\n");
+   printf("4) look up the country codes belonging to the IP addresses in the lines of a file or of stdin:\n\n");
+   printf("   %s -b [-e engine] [-r bstfiles] [file]\n", r);
+   printf("      -b                Batch mode, read newline separated IPv4 and IPv6 addresses from the file or, if it\n");
+   printf("                        is omitted or -, from stdin, and write the lines 'address<TAB>CC' to stdout. The CC\n");
+   printf("                        is -- for addresses which are not found, and ?? for invalid addresses.\n\n");
+   printf("5) serve lookups of country codes on a local socket:\n\n");
+   printf("   %s -s socket [-e engine] [-r bstfiles]\n", r);
+   printf("      -s socket         Server mode, keep the tables resident and answer the lookup requests at the UNIX\n");
+   printf("                        domain socket path (containing a /), or at the loopback TCP [address:]port.\n");
+   printf("                        A request is the byte 4 followed by an IPv4 address, or the byte 6 followed by\n");
+   printf("                        an IPv6 address, in network byte order, and the answer is the 2 letter CC or --.\n");
+   printf("                        The requests may be pipelined, and the answers are sent in the same order.\n");
+   printf("                        On SIGHUP, the server reloads the tables, e.g. after they were updated by ipdb.\n\n");
 }
 
 
-CCNode **CCTable  = NULL;
+CCEntry *CCTable = NULL;
 
 static inline uint32_t ccv(uint16_t cc, int32_t toff)
 {
@@ -81,25 +123,1090 @@ static inline uint32_t ccv(uint16_t cc, int32_t toff)
    return (0 <= val && val <= 4294967295) ? (uint32_t)val : 0; // the result mut be a 32-bit unsigned value
 }
 
+
+// Table emitter -- the lines of the second usage form are formatted directly into the growing buffers of the chunks,
+// the IPv4 octets by a table of their decimal strings, and the IPv6 words by their hex nibbles, and the buffers are
+// written by large writes, which flush stdio before, so that the output of printf() keeps its place.
+
+#define emitBuffer 1048576                // the initial size of a chunk buffer, and the flush size in difference mode
+#define emitMargin 128                    // the space for at least one line
+
+typedef struct
+{
+   char *data;
+   int   length, size;
+   int   lines;
+   int   chunk;                           // the number of the chunk in the slot, or -1 if the slot is free
+   bool  done;
+} Chunk;
+
+char octetStrings[256][4];                // the decimal digits of an octet, and their count in the 4th byte
+
+static void initOctetStrings(void)
+{
+   for (int i = 0; i < 256; i++)
+   {
+      char *o = octetStrings[i];
+      if (i >= 100)
+         *o++ = '0' + i/100;
+      if (i >= 10)
+         *o++ = '0' + i/10%10;
+      *o++ = '0' + i%10;
+      octetStrings[i][3] = (char)(o - octetStrings[i]);
+   }
+}
+
+static void emitFlush(Chunk *chunk)
+{
+   fflush(stdout);
+   for (int pos = 0, rc; pos < chunk->length; pos += rc)
+      if ((rc = (int)write(STDOUT_FILENO, &chunk->data[pos], chunk->length - pos)) < 0)
+         if (errno == EINTR)
+            rc = 0;
+         else
+            break;
+
+   chunk->length = 0;
+}
+
+static inline char *emitBegin(Chunk *chunk)
+{
+   if (chunk->length > chunk->size - emitMargin)
+   {
+      int size = (chunk->size) ? 2*chunk->size : emitBuffer;
+      if (!(chunk->data = reallocate(chunk->data, size, false, true)))
+         return NULL;
+      chunk->size = size;
+   }
+
+   return &chunk->data[chunk->length];
+}
+
+static inline void emitEnd(Chunk *chunk, char *q)
+{
+   chunk->length = (int)(q - chunk->data);
+   chunk->lines++;
+}
+
+static inline char *emitUInt(char *q, uint32_t v)
+{
+   char digits[10];
+   int  n = 0;
+
+   do
+      digits[n++] = '0' + v%10;
+   while (v /= 10);
+
+   while (n)
+      *q++ = digits[--n];
+   return q;
+}
+
+static inline char *emitIP4(char *q, uint32_t ip)
+{
+   for (int s = 24; s >= 0; s -= 8)
+   {
+      const char *o = octetStrings[ip >> s & 0xFF];
+      memcpy(q, o, 4);                    // the 4th byte gets overwritten by the next octet or the dot
+      q += o[3];
+      *q++ = '.';
+   }
+
+   return q - 1;
+}
+
+static inline char *emitIP6(char *q, uint128t ip)
+{
+   static const char nibbles[16] = "0123456789abcdef";
+   IP6Desc ipdsc = {.number = ip};
+
+   for (int k = 7; k >= 0; k--)
+   {
+      uint32_t w = ipdsc.word[k ^ b8_0];  // b8_k in either byte order
+      int      s = (w) ? (31 - __builtin_clz(w)) & ~3 : 0;
+      for (; s >= 0; s -= 4)
+         *q++ = nibbles[w >> s & 0xF];
+      *q++ = ':';
+   }
+
+   return q - 1;
+}
+
+static inline char *emitString(char *q, const char *str, int len)
+{
+   memcpy(q, str, len);
+   return q + len;
+}
+
+
+// Parallel table generation -- the sorted sets are split into chunks of chunkSets ranges, the worker threads take the
+// chunks in ascending order and format their lines into the buffers of a ring of slots, and the main thread writes the
+// buffers in the order of the chunks, so that the output is byte for byte the one of a single thread.
+
+#define maxWorkers 64
+#define chunkSets  4096
+
+typedef struct
+{
+   void    *sets;                         // IP4Set or IP6Set
+   int      count, chunks;
+   bool     ip6;
+
+   char    *ccList;
+   bool     plainFlag, ccValFlag, aggregate;
+   uint32_t tval;
+   int32_t  toff;
+   char     prefix[32], delPrefix[32];      // the directives in front of the added and of the deleted prefixes
+   int      prefixlen, delPrefixlen;
+
+   int      next;                         // the next chunk to be taken by a worker
+   int      written;                      // the number of chunks written by the main thread
+   bool     failed;
+   int      slotCount;
+   Chunk    slots[2*maxWorkers];
+
+   pthread_mutex_t lock;
+   pthread_cond_t  formatted, freed;
+} Generator;
+
+static inline uint32_t tableValue(Generator *gen, uint32_t ui, uint16_t cc)
+{
+   return (gen->plainFlag) ? 0 : (ui) ? ui : (gen->tval) ? gen->tval : (gen->ccValFlag) ? ccv(cc, gen->toff) : 0;
+}
+
+// Returns false if the ranges of the given CC are not selected, otherwise true and their table value.
+static inline bool selectRange(Generator *gen, uint32_t cc, uint16_t cc16, uint32_t *value)
+{
+   CCEntry *ccn = NULL;
+
+   if (*gen->ccList && !(ccn = findCC(CCTable, cc)))
+      return false;
+
+   *value = tableValue(gen, (ccn) ? ccn->ui : 0, cc16);
+   return true;
+}
+
+// In aggregation mode, the touching ranges with the same table value are merged into runs, which are decomposed as a
+// whole. The prefixes of a run are disjoint, and since its greedy decomposition is minimal, and no prefix can cross a
+// gap or the border to a different value, the union of the decompositions is the minimal disjoint CIDR cover of the
+// selected address space with the given values. A run belongs to the chunk in which it begins.
+
+static inline bool joinsIP4(Generator *gen, IP4Set *sets, int i)
+{
+   uint32_t v, w;
+   return sets[i-1][1] != UINT32_MAX && sets[i][0] == sets[i-1][1] + 1
+       && selectRange(gen, sets[i-1][2], (uint16_t)sets[i-1][2], &v)
+       && selectRange(gen, sets[i][2], (uint16_t)sets[i][2], &w) && v == w;
+}
+
+static inline bool joinsIP6(Generator *gen, IP6Set *sets, int i)
+{
+   uint32_t v, w;
+   return lt_u128(sets[i-1][1], sub_u128(u64_to_u128t(0), u64_to_u128t(1)))
+       && eq_u128(sets[i][0], add_u128(sets[i-1][1], u64_to_u128t(1)))
+       && selectRange(gen, *(uint32_t*)&sets[i-1][2], *(uint16_t*)&sets[i-1][2], &v)
+       && selectRange(gen, *(uint32_t*)&sets[i][2], *(uint16_t*)&sets[i][2], &w) && v == w;
+}
+
+static inline char *emitValue(Generator *gen, char *q, uint32_t value)
+{
+   if (!gen->plainFlag && (value != 0 || gen->ccValFlag))
+      *q++ = ' ', q = emitUInt(q, value);
+   return q;
+}
+
+static inline bool emitIP4Line(Generator *gen, Chunk *chunk, bool add, IP4Prefix *prefix, uint32_t value)
+{
+   char *q = emitBegin(chunk);
+   if (!q)
+      return false;
+
+   q = (add) ? emitString(q, gen->prefix, gen->prefixlen) : emitString(q, gen->delPrefix, gen->delPrefixlen);
+   q = emitIP4(q, prefix->ip);
+   *q++ = '/';
+   q = emitUInt(q, 32 - prefix->m);
+   if (add)
+      q = emitValue(gen, q, value);
+   *q++ = '\n';
+   emitEnd(chunk, q);
+   return true;
+}
+
+static inline bool emitIP6Line(Generator *gen, Chunk *chunk, bool add, IP6Prefix *prefix, uint32_t value)
+{
+   char *q = emitBegin(chunk);
+   if (!q)
+      return false;
+
+   q = (add) ? emitString(q, gen->prefix, gen->prefixlen) : emitString(q, gen->delPrefix, gen->delPrefixlen);
+   q = emitIP6(q, prefix->ip);
+   *q++ = '/';
+   q = emitUInt(q, 128 - prefix->m);
+   if (add)
+      q = emitValue(gen, q, value);
+   *q++ = '\n';
+   emitEnd(chunk, q);
+   return true;
+}
+
+static bool formatIP4Chunk(Generator *gen, Chunk *chunk)
+{
+   IP4Set   *sets = gen->sets;
+   IP4Prefix prefixes[maxIP4Prefixes];
+   uint32_t  value;
+   int i = chunk->chunk*chunkSets, n = (gen->count - i > chunkSets) ? i + chunkSets : gen->count;
+
+   while (gen->aggregate && i > 0 && i < n && joinsIP4(gen, sets, i))
+      i++;
+
+   for (; i < n; i++)
+      if (selectRange(gen, sets[i][2], (uint16_t)sets[i][2], &value))
+      {
+         uint32_t lo = sets[i][0], hi = sets[i][1];
+         while (gen->aggregate && i + 1 < gen->count && joinsIP4(gen, sets, i + 1))
+            hi = sets[++i][1];
+
+         int k, np = rangeIP4Prefixes(lo, hi, prefixes);
+         for (k = 0; k < np; k++)
+            if (!emitIP4Line(gen, chunk, true, &prefixes[k], value))
+               return false;
+      }
+
+   return true;
+}
+
+static bool formatIP6Chunk(Generator *gen, Chunk *chunk)
+{
+   IP6Set   *sets = gen->sets;
+   IP6Prefix prefixes[maxIP6Prefixes];
+   uint32_t  value;
+   int i = chunk->chunk*chunkSets, n = (gen->count - i > chunkSets) ? i + chunkSets : gen->count;
+
+   while (gen->aggregate && i > 0 && i < n && joinsIP6(gen, sets, i))
+      i++;
+
+   for (; i < n; i++)
+      if (selectRange(gen, *(uint32_t*)&sets[i][2], *(uint16_t*)&sets[i][2], &value))
+      {
+         uint128t lo = sets[i][0], hi = sets[i][1];
+         while (gen->aggregate && i + 1 < gen->count && joinsIP6(gen, sets, i + 1))
+            hi = sets[++i][1];
+
+         int k, np = rangeIP6Prefixes(lo, hi, prefixes);
+         for (k = 0; k < np; k++)
+            if (!emitIP6Line(gen, chunk, true, &prefixes[k], value))
+               return false;
+      }
+
+   return true;
+}
+
+static inline bool formatChunk(Generator *gen, Chunk *chunk)
+{
+   return (gen->ip6) ? formatIP6Chunk(gen, chunk) : formatIP4Chunk(gen, chunk);
+}
+
+static void *formatter(void *arg)
+{
+   Generator *gen = arg;
+   Chunk     *chunk;
+   int        c;
+
+   pthread_mutex_lock(&gen->lock);
+   while (!gen->failed && (c = gen->next++) < gen->chunks)
+   {
+      // the slot is free as soon as the chunk which was slotCount chunks before has been written
+      chunk = &gen->slots[c % gen->slotCount];
+      while (c >= gen->written + gen->slotCount && !gen->failed)
+         pthread_cond_wait(&gen->freed, &gen->lock);
+      if (gen->failed)
+         break;
+
+      chunk->chunk = c;
+      chunk->done  = false;
+      pthread_mutex_unlock(&gen->lock);
+
+      bool ok = formatChunk(gen, chunk);
+
+      pthread_mutex_lock(&gen->lock);
+      if (!ok)
+      {
+         gen->failed = true;
+         pthread_cond_broadcast(&gen->freed);
+      }
+      chunk->done = true;
+      pthread_cond_broadcast(&gen->formatted);
+   }
+   pthread_mutex_unlock(&gen->lock);
+
+   return NULL;
+}
+
+// Returns the number of the generated lines, or -1 if the memory for the buffers could not be allocated.
+static int generateTable(Generator *gen, int workers)
+{
+   pthread_t threads[maxWorkers];
+   Chunk    *chunk;
+   int       c, t, lines = 0;
+
+   gen->chunks    = (gen->count + chunkSets - 1)/chunkSets;
+   gen->next      = 0;
+   gen->written   = 0;
+   gen->failed    = false;
+   gen->slotCount = 2*workers;
+   for (c = 0; c < gen->slotCount; c++)
+      gen->slots[c].chunk = -1;
+
+   for (t = 0; workers > 1 && t < workers && t < gen->chunks; t++)
+      if (pthread_create(&threads[t], NULL, formatter, gen) != 0)
+         break;
+
+   for (c = 0; c < gen->chunks; c++)
+   {
+      if (t == 0)
+      {
+         // single threaded
+         chunk = &gen->slots[0];
+         chunk->chunk = c;
+         if (!formatChunk(gen, chunk))
+            gen->failed = true;
+      }
+      else
+      {
+         chunk = &gen->slots[c % gen->slotCount];
+         pthread_mutex_lock(&gen->lock);
+         while (!gen->failed && !(chunk->chunk == c && chunk->done))
+            pthread_cond_wait(&gen->formatted, &gen->lock);
+         pthread_mutex_unlock(&gen->lock);
+      }
+
+      if (gen->failed)
+         break;
+
+      lines += chunk->lines;
+      emitFlush(chunk);
+
+      pthread_mutex_lock(&gen->lock);
+      chunk->chunk = -1;
+      chunk->lines = 0;
+      gen->written++;
+      pthread_cond_broadcast(&gen->freed);
+      pthread_mutex_unlock(&gen->lock);
+   }
+
+   while (t)
+      pthread_join(threads[--t], NULL);
+
+   for (c = 0; c < gen->slotCount; c++)
+   {
+      deallocate(VPR(gen->slots[c].data), false);
+      gen->slots[c].length = gen->slots[c].size = gen->slots[c].lines = 0;
+   }
+
+   return (gen->failed) ? -1 : lines;
+}
+
+
+// Difference mode -- walkers generate the prefixes of the previous and of the new tables in ascending order of their
+// addresses, and both sequences are merged in one pass. Only the prefixes which vanished or changed their value are
+// deleted, and only the new or changed ones are added, whereby a changed prefix is deleted before it is added again.
+
+typedef struct
+{
+   Generator *gen;
+   IP4Set    *sets;
+   int        count, i, k, np;
+   uint32_t   value;
+   IP4Prefix  prefixes[maxIP4Prefixes];
+} IP4Walk;
+
+typedef struct
+{
+   Generator *gen;
+   IP6Set    *sets;
+   int        count, i, k, np;
+   uint32_t   value;
+   IP6Prefix  prefixes[maxIP6Prefixes];
+} IP6Walk;
+
+static bool nextIP4Prefix(IP4Walk *w, IP4Prefix *prefix, uint32_t *value)
+{
+   while (w->k == w->np)
+   {
+      if (w->i == w->count)
+         return false;
+
+      int i = w->i++;
+      if (selectRange(w->gen, w->sets[i][2], (uint16_t)w->sets[i][2], &w->value))
+      {
+         uint32_t hi = w->sets[i][1];
+         while (w->gen->aggregate && w->i < w->count && joinsIP4(w->gen, w->sets, w->i))
+            hi = w->sets[w->i++][1];
+
+         w->np = rangeIP4Prefixes(w->sets[i][0], hi, w->prefixes);
+         w->k  = 0;
+      }
+   }
+
+   *prefix = w->prefixes[w->k++];
+   *value  = w->value;
+   return true;
+}
+
+static bool nextIP6Prefix(IP6Walk *w, IP6Prefix *prefix, uint32_t *value)
+{
+   while (w->k == w->np)
+   {
+      if (w->i == w->count)
+         return false;
+
+      int i = w->i++;
+      if (selectRange(w->gen, *(uint32_t*)&w->sets[i][2], *(uint16_t*)&w->sets[i][2], &w->value))
+      {
+         uint128t hi = w->sets[i][1];
+         while (w->gen->aggregate && w->i < w->count && joinsIP6(w->gen, w->sets, w->i))
+            hi = w->sets[w->i++][1];
+
+         w->np = rangeIP6Prefixes(w->sets[i][0], hi, w->prefixes);
+         w->k  = 0;
+      }
+   }
+
+   *prefix = w->prefixes[w->k++];
+   *value  = w->value;
+   return true;
+}
+
+static bool diffIP4Tables(Generator *gen, Chunk *chunk, IP4Set *oldSets, int oldCount)
+{
+   IP4Walk   o = {gen, oldSets, oldCount}, n = {gen, gen->sets, gen->count};
+   IP4Prefix op, np;
+   uint32_t  ov, nv;
+   bool      oh = nextIP4Prefix(&o, &op, &ov),
+             nh = nextIP4Prefix(&n, &np, &nv);
+
+   while (oh || nh)
+   {
+      if (chunk->length > emitBuffer - emitMargin)
+         emitFlush(chunk);
+
+      if (!nh || oh && op.ip < np.ip)
+      {
+         if (!emitIP4Line(gen, chunk, false, &op, ov))
+            return false;
+         oh = nextIP4Prefix(&o, &op, &ov);
+      }
+
+      else if (!oh || np.ip < op.ip)
+      {
+         if (!emitIP4Line(gen, chunk, true, &np, nv))
+            return false;
+         nh = nextIP4Prefix(&n, &np, &nv);
+      }
+
+      else
+      {
+         if ((op.m != np.m || ov != nv) && (!emitIP4Line(gen, chunk, false, &op, ov) || !emitIP4Line(gen, chunk, true, &np, nv)))
+            return false;
+         oh = nextIP4Prefix(&o, &op, &ov);
+         nh = nextIP4Prefix(&n, &np, &nv);
+      }
+   }
+
+   return true;
+}
+
+static bool diffIP6Tables(Generator *gen, Chunk *chunk, IP6Set *oldSets, int oldCount)
+{
+   IP6Walk   o = {gen, oldSets, oldCount}, n = {gen, gen->sets, gen->count};
+   IP6Prefix op, np;
+   uint32_t  ov, nv;
+   bool      oh = nextIP6Prefix(&o, &op, &ov),
+             nh = nextIP6Prefix(&n, &np, &nv);
+
+   while (oh || nh)
+   {
+      if (chunk->length > emitBuffer - emitMargin)
+         emitFlush(chunk);
+
+      if (!nh || oh && lt_u128(op.ip, np.ip))
+      {
+         if (!emitIP6Line(gen, chunk, false, &op, ov))
+            return false;
+         oh = nextIP6Prefix(&o, &op, &ov);
+      }
+
+      else if (!oh || lt_u128(np.ip, op.ip))
+      {
+         if (!emitIP6Line(gen, chunk, true, &np, nv))
+            return false;
+         nh = nextIP6Prefix(&n, &np, &nv);
+      }
+
+      else
+      {
+         if ((op.m != np.m || ov != nv) && (!emitIP6Line(gen, chunk, false, &op, ov) || !emitIP6Line(gen, chunk, true, &np, nv)))
+            return false;
+         oh = nextIP6Prefix(&o, &op, &ov);
+         nh = nextIP6Prefix(&n, &np, &nv);
+      }
+   }
+
+   return true;
+}
+
+// Returns the number of the output directives, or -1 if the memory for the buffer could not be allocated.
+static int diffTables(Generator *gen, void *oldSets, int oldCount)
+{
+   Chunk chunk = {.chunk = -1};
+   bool  ok    = (gen->ip6) ? diffIP6Tables(gen, &chunk, oldSets, oldCount) : diffIP4Tables(gen, &chunk, oldSets, oldCount);
+
+   if (ok)
+      emitFlush(&chunk);
+   deallocate(VPR(chunk.data), false);
+   return (ok) ? chunk.lines : -1;
+}
+
+
+// Batch mode -- the lines are read in chunks, the addresses of a chunk are collected in batches, looked up by the
+// batched searches, and the results are written in the order of the input to a large output buffer.
+
+#define batchLines 4096
+#define bufferSize 1048576
+
+typedef struct
+{
+   int      count, count4, count6;
+   char    *lines[batchLines];
+   int      lens[batchLines];
+   int      slots[batchLines];      // the index into ip4s, batchLines + the index into ip6s, or -1 for invalid addresses
+   uint32_t ip4s[batchLines];
+   uint128t ip6s[batchLines];
+   int      index4[batchLines];
+   int      index6[batchLines];
+   char    *out;
+   int      outlen;
+} Batch;
+
+static void flushBatch(Batch *batch, IP4Table *ip4table, IP6Table *ip6table)
+{
+   tableIP4SearchBatch(batch->ip4s, batch->index4, batch->count4, ip4table);
+   tableIP6SearchBatch(batch->ip6s, batch->index6, batch->count6, ip6table);
+
+   for (int i = 0; i < batch->count; i++)
+   {
+      int   len  = batch->lens[i], slot = batch->slots[i], o;
+      char *cc;
+
+      if (slot < 0)
+         cc = "??";
+      else if (slot < batchLines)
+         cc = ((o = batch->index4[slot]) >= 0) ? (char *)&ip4table->sets[o][2] : "--";
+      else
+         cc = ((o = batch->index6[slot - batchLines]) >= 0) ? (char *)&ip6table->sets[o][2] : "--";
+
+      if (batch->outlen + len + 4 > bufferSize)
+      {
+         fwrite(batch->out, 1, batch->outlen, stdout);
+         batch->outlen = 0;
+
+         if (len + 4 > bufferSize)         // an overlong line does not fit into the empty buffer either
+         {
+            fwrite(batch->lines[i], 1, len, stdout);
+            fprintf(stdout, "\t%c%c\n", cc[0], cc[1]);
+            continue;
+         }
+      }
+
+      char *q = batch->out + batch->outlen;
+      memcpy(q, batch->lines[i], len);
+      q[len]   = '\t';
+      q[len+1] = cc[0];
+      q[len+2] = cc[1];
+      q[len+3] = '\n';
+      batch->outlen += len + 4;
+   }
+
+   batch->count = batch->count4 = batch->count6 = 0;
+}
+
+static inline void batchLine(Batch *batch, char *line, int len, IP4Table *ip4table, IP6Table *ip6table)
+{
+   uint128t ipv6;
+   int      n = batch->count;
+
+   batch->lines[n] = line;
+   batch->lens[n]  = len;
+
+   if (!memchr(line, ':', len))
+   {
+      if (batch->ip4s[batch->count4] = ipv4_str2bin(line))
+         batch->slots[n] = batch->count4++;
+      else
+         batch->slots[n] = -1;
+   }
+
+   else if (gt_u128(ipv6 = ipv6_str2bin(line), u64_to_u128t(0)))
+   {
+      batch->ip6s[batch->count6] = ipv6;
+      batch->slots[n] = batchLines + batch->count6++;
+   }
+
+   else
+      batch->slots[n] = -1;
+
+   if (++batch->count == batchLines)
+      flushBatch(batch, ip4table, ip6table);
+}
+
+int64_t batchLookup(FILE *in, IP4Table *ip4table, IP6Table *ip6table)
+{
+   int64_t count = 0;
+   ssize_t rc;
+   size_t  bytesread, offset = 0, complete;
+   bool    eof = false;
+   int     fd = fileno(in);
+   char   *data  = allocate(bufferSize+16, false);
+   Batch  *batch = allocate(sizeof(Batch), false);
+
+   if (!data || !batch || !(batch->out = allocate(bufferSize, false)))
+   {
+      deallocate_batch(false, VPR(data), VPR(batch), NULL);
+      return -1;
+   }
+
+   batch->count = batch->count4 = batch->count6 = batch->outlen = 0;
+
+   // read(2) returns what is available, so that the answers to a streaming input are not held back until
+   // the buffer is full, and the output of each chunk is flushed
+   while (!eof || offset)
+   {
+      if (eof)
+         bytesread = offset;
+      else if ((rc = read(fd, data+offset, bufferSize-offset)) > 0)
+         bytesread = offset + rc;
+      else if (rc < 0 && errno == EINTR)
+         continue;
+      else
+         eof = true, bytesread = offset;
+
+      data[bytesread] = '\0';
+
+      // only the complete lines are processed, and the incomplete last line is moved to the beginning of the buffer,
+      // unless it is the last line of the input or it does not fit into the buffer
+      for (complete = bytesread; complete > 0 && data[complete-1] != '\n'; complete--);
+      if (complete == 0 && !eof && bytesread < bufferSize)
+      {
+         offset = bytesread;
+         continue;
+      }
+      if (complete == 0 || eof)
+         complete = bytesread;
+
+      int   ll;
+      char *line = data, *end = data + complete;
+      while (line < end)
+      {
+         char *nextline = line + (ll = linelen(line)) + 1;
+         line[ll] = '\0';
+
+         while (*line && *line <= ' ')
+            line++, ll--;
+         while (ll > 0 && line[ll-1] <= ' ')
+            line[--ll] = '\0';
+
+         if (ll > 0)
+         {
+            batchLine(batch, line, ll, ip4table, ip6table);
+            count++;
+         }
+
+         line = nextline;
+      }
+
+      flushBatch(batch, ip4table, ip6table);
+      fwrite(batch->out, 1, batch->outlen, stdout);
+      fflush(stdout);
+      batch->outlen = 0;
+
+      memmove(data, data + complete, offset = bytesread - complete);
+   }
+
+   deallocate(VPR(batch->out), false);
+   deallocate_batch(false, VPR(data), VPR(batch), NULL);
+   return count;
+}
+
+
+// Server mode -- a single threaded event loop, which reads as many requests of a client as are available, looks up
+// all the complete ones by the batched searches, and answers them by a single write. Further requests of a client
+// are read only when all its answers were written.
+
+#define serverBuffer  65536
+#define maxRequests   (serverBuffer/5)
+
+typedef struct
+{
+   int      sock;
+   int      inlen;
+   int      outpos, outlen;
+   uint8_t  in[serverBuffer];
+   uint8_t  out[2*maxRequests];
+} Connection;
+
+uint32_t requestIP4s[maxRequests];
+uint128t requestIP6s[maxRequests];
+int      requestSlots[maxRequests];         // the index into requestIP4s, or maxRequests + the index into requestIP6s
+int      requestIndex4[maxRequests];
+int      requestIndex6[maxRequests];
+
+char *serverPath = NULL;
+
+void unlinkServerPath(void)
+{
+   if (serverPath)
+      unlink(serverPath);
+}
+
+// The signal handlers only set the flags, which are checked by the event loop, since calling exit() from a
+// handler would run the atexit() handlers and flush stdio, which is not async-signal-safe.
+
+volatile sig_atomic_t stopRequested = 0;
+
+static void stopServer(int sig)
+{
+   stopRequested = 1;
+}
+
+volatile sig_atomic_t reloadRequested = 0;
+
+static void requestReload(int sig)
+{
+   reloadRequested = 1;
+}
+
+// ipdb replaces the table files by rename(2), so the new tables are mapped from the new inodes, while the current ones
+// stay valid, and only if both new tables could be loaded, they are swapped in and the current ones are unmapped. The
+// server is single threaded, and the reload happens between the requests.
+static void reloadTables(char *bstfname, LookupEngine ip4engine, LookupEngine ip6engine, IP4Table **ip4table, IP6Table **ip6table)
+{
+   IP4Table *ip4new;
+   IP6Table *ip6new;
+   int       namelen = strvlen(bstfname);
+   char     *inName  = strcpy(alloca(namelen+4), bstfname);
+
+   *(uint32_t *)&inName[namelen] = *(uint32_t *)".v4";
+   if (ip4new = loadIP4Table(inName, ip4engine, residentAccess))
+   {
+      *(uint32_t *)&inName[namelen] = *(uint32_t *)".v6";
+      if (ip6new = loadIP6Table(inName, ip6engine, residentAccess))
+      {
+         releaseIP4Table(*ip4table);
+         releaseIP6Table(*ip6table);
+         *ip4table = ip4new;
+         *ip6table = ip6new;
+         return;
+      }
+
+      releaseIP4Table(ip4new);
+   }
+
+   printf("The IP ranges could not be reloaded, the current ones stay in use.\n");
+   fflush(stdout);
+}
+
+static bool nonblocking(int sock)
+{
+   int flags = fcntl(sock, F_GETFL, 0);
+   return flags >= 0 && fcntl(sock, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+// Open the listening socket at the UNIX domain socket path, if the name contains a slash,
+// otherwise at the TCP [address:]port, where the address defaults to the loopback address.
+static int listenSocket(char *name)
+{
+   int sock;
+
+   if (strchr(name, '/'))
+   {
+      struct sockaddr_un address = {.sun_family = AF_UNIX};
+      if (strvlen(name) >= sizeof(address.sun_path))
+         return -1;
+
+      strcpy(address.sun_path, name);
+      unlink(name);
+      if ((sock = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+         return -1;
+
+      if (bind(sock, (struct sockaddr *)&address, sizeof(address)) < 0)
+      {
+         close(sock);
+         return -1;
+      }
+
+      serverPath = name;
+      atexit(unlinkServerPath);
+   }
+
+   else
+   {
+      struct addrinfo *ai, hints = {.ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM};
+      char *port = strrchr(name, ':'), *host = "localhost";
+      if (port)
+      {
+         *port++ = '\0';
+         host = name;
+      }
+      else
+         port = name;
+
+      if (getaddrinfo(host, port, &hints, &ai) != 0)
+         return -1;
+
+      if ((sock = socket(ai->ai_family, SOCK_STREAM, 0)) >= 0)
+      {
+         int on = 1;
+         setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+         if (bind(sock, ai->ai_addr, ai->ai_addrlen) < 0)
+         {
+            close(sock);
+            sock = -1;
+         }
+      }
+
+      freeaddrinfo(ai);
+      if (sock < 0)
+         return -1;
+   }
+
+   if (listen(sock, SOMAXCONN) < 0 || !nonblocking(sock))
+   {
+      close(sock);
+      return -1;
+   }
+
+   return sock;
+}
+
+
+// Registration of the sockets with epoll or kqueue -- a connection is watched either for reading or for writing.
+
+static inline bool pollerWatch(int poller, int sock, void *data, bool writing, bool added)
+{
+#if defined(__linux__)
+   struct epoll_event ev = {.events = (writing) ? EPOLLOUT : EPOLLIN, .data.ptr = data};
+   return epoll_ctl(poller, (added) ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, sock, &ev) == 0;
+#else
+   struct kevent ev[2];
+   EV_SET(&ev[0], sock, EVFILT_READ,  EV_ADD | ((writing) ? EV_DISABLE : EV_ENABLE), 0, 0, data);
+   EV_SET(&ev[1], sock, EVFILT_WRITE, EV_ADD | ((writing) ? EV_ENABLE : EV_DISABLE), 0, 0, data);
+   return kevent(poller, ev, 2, NULL, 0, NULL) == 0;
+#endif
+}
+
+static inline int pollerWait(int poller, void **ready, int max)
+{
+   int n;
+
+#if defined(__linux__)
+   struct epoll_event evs[max];
+   if ((n = epoll_wait(poller, evs, max, -1)) > 0)
+      for (int i = 0; i < n; i++)
+         ready[i] = evs[i].data.ptr;
+#else
+   struct kevent evs[max];
+   if ((n = kevent(poller, NULL, 0, evs, max, NULL)) > 0)
+      for (int i = 0; i < n; i++)
+         ready[i] = evs[i].udata;
+#endif
+
+   return n;
+}
+
+
+static void closeConnection(Connection *conn)
+{
+   close(conn->sock);                     // this removes the socket from the poller as well
+   deallocate(VPR(conn), false);
+}
+
+// Answer the complete requests in the input buffer, and keep an incomplete one for the next read.
+// Returns false if the client sent an invalid request.
+static bool answerRequests(Connection *conn, IP4Table *ip4table, IP6Table *ip6table)
+{
+   int n = 0, n4 = 0, n6 = 0, pos = 0;
+
+   while (pos < conn->inlen)
+      if (conn->in[pos] == 4 && pos + 5 <= conn->inlen)
+      {
+         uint32_t ip;
+         memcpy(&ip, &conn->in[pos+1], sizeof(uint32_t));
+         requestIP4s[n4] = swapInt32(ip);
+         requestSlots[n++] = n4++;
+         pos += 5;
+      }
+
+      else if (conn->in[pos] == 6 && pos + 17 <= conn->inlen)
+      {
+         uint64_t ip[2];
+         memcpy(ip, &conn->in[pos+1], 2*sizeof(uint64_t));
+         requestIP6s[n6] = (IP6Desc){swapInt64(ip[b2_1]), swapInt64(ip[b2_0])}.number;
+         requestSlots[n++] = maxRequests + n6++;
+         pos += 17;
+      }
+
+      else if (conn->in[pos] == 4 || conn->in[pos] == 6)
+         break;
+
+      else
+         return false;
+
+   tableIP4SearchBatch(requestIP4s, requestIndex4, n4, ip4table);
+   tableIP6SearchBatch(requestIP6s, requestIndex6, n6, ip6table);
+
+   for (int i = 0, o; i < n; i++)
+   {
+      int slot = requestSlots[i];
+      if (slot < maxRequests)
+         memcpy(&conn->out[2*i], ((o = requestIndex4[slot]) >= 0) ? (char *)&ip4table->sets[o][2] : "--", 2);
+      else
+         memcpy(&conn->out[2*i], ((o = requestIndex6[slot - maxRequests]) >= 0) ? (char *)&ip6table->sets[o][2] : "--", 2);
+   }
+
+   conn->outpos = 0;
+   conn->outlen = 2*n;
+   memmove(conn->in, &conn->in[pos], conn->inlen -= pos);
+   return true;
+}
+
+// Write the pending answers, and if all were written, read and answer the next requests. Returns 1 if the
+// connection waits for writing, 0 if it waits for reading, and -1 if it is closed or failed.
+static int serveConnection(Connection *conn, IP4Table *ip4table, IP6Table *ip6table)
+{
+   ssize_t rc;
+
+   for (;;)
+   {
+      while (conn->outpos < conn->outlen)
+         if ((rc = write(conn->sock, &conn->out[conn->outpos], conn->outlen - conn->outpos)) > 0)
+            conn->outpos += rc;
+         else if (rc < 0 && errno == EINTR)
+            continue;
+         else if (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return 1;
+         else
+            return -1;
+
+      if ((rc = read(conn->sock, &conn->in[conn->inlen], serverBuffer - conn->inlen)) > 0)
+      {
+         conn->inlen += rc;
+         if (!answerRequests(conn, ip4table, ip6table))
+            return -1;
+      }
+      else if (rc < 0 && errno == EINTR)
+         continue;
+      else if (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+         return 0;
+      else
+         return -1;                       // end of the connection, or an error
+   }
+}
+
+int lookupServer(char *name, char *bstfname, LookupEngine ip4engine, LookupEngine ip6engine, IP4Table **ip4table, IP6Table **ip6table)
+{
+   int   server, poller, n;
+   void *ready[64];
+
+   if ((server = listenSocket(name)) < 0)
+      return -1;
+
+#if defined(__linux__)
+   poller = epoll_create1(0);
+#else
+   poller = kqueue();
+#endif
+   if (poller < 0 || !pollerWatch(poller, server, NULL, false, false))
+      return -1;
+
+   signal(SIGPIPE, SIG_IGN);
+   signal(SIGINT,  stopServer);
+   signal(SIGTERM, stopServer);
+   signal(SIGHUP,  requestReload);
+
+   while (!stopRequested)
+   {
+      if (reloadRequested)
+      {
+         reloadRequested = 0;
+         reloadTables(bstfname, ip4engine, ip6engine, ip4table, ip6table);
+      }
+
+      if ((n = pollerWait(poller, ready, 64)) < 0)
+         if (errno == EINTR)
+            continue;
+         else
+            return -1;
+
+      for (int i = 0; i < n; i++)
+         if (ready[i] == NULL)
+         {
+            Connection *conn;
+            int sock;
+            while ((sock = accept(server, NULL, NULL)) >= 0)
+               if (!nonblocking(sock) || !(conn = allocate(sizeof(Connection), false)))
+                  close(sock);
+               else
+               {
+                  conn->sock  = sock;
+                  conn->inlen = conn->outpos = conn->outlen = 0;
+                  if (!pollerWatch(poller, sock, conn, false, false))
+                     closeConnection(conn);
+               }
+         }
+
+         else
+         {
+            Connection *conn = ready[i];
+            int writing = serveConnection(conn, *ip4table, *ip6table);
+            if (writing < 0 || !pollerWatch(poller, conn->sock, conn, writing, true))
+               closeConnection(conn);
+         }
+   }
+
+   close(poller);
+   close(server);
+   return 0;                              // the socket path is unlinked by atexit()
+}
+
+
 int main(int argc, char *argv[])
 {
    bool plainFlag = false,
         ccValFlag = false,
         only4Flag = false,
-        only6Flag = false;
+        only6Flag = false,
+        aggrFlag  = false,
+        batchFlag = false;
+
+   char *serverName = NULL;
 
    int32_t  ch,
-            rc    = 1,
-            tnum  = 0,
-            toff  = 0;
+            rc      = 1,
+            tnum    = 0,
+            toff    = 0,
+            workers = (int32_t)sysconf(_SC_NPROCESSORS_ONLN);
    uint32_t tval  = 0;
 
-   char *ccList   = NULL,
-        *bstfname = "/usr/local/etc/ipdb/IPRanges/ipcc.bst",   // actually 2 files *.v4 and *.v6
-        *cmd      = argv[0],
-        *lastopt  = "";
+   char *ccList      = NULL,
+        *bstfname    = "/usr/local/etc/ipdb/IPRanges/ipcc.bst",   // actually 2 files *.v4 and *.v6
+        *oldbstfname = NULL,                                      // the previous tables in difference mode
+        *cmd         = argv[0],
+        *lastopt     = "";
 
-   while ((ch = getopt(argc, argv, "t:n:pv:x:46r:h:q:")) != -1)
+   LookupEngine ip4engine = bisectionEngine,
+                ip6engine = bisectionEngine;
+
+   while ((ch = getopt(argc, argv, "t:n:pv:x:ad:46w:bs:e:r:h:q:")) != -1)
    {
       switch (ch)
       {
@@ -137,6 +1244,14 @@ int main(int argc, char *argv[])
             ccValFlag = true;
             break;
 
+         case 'a':
+            aggrFlag = true;
+            break;
+
+         case 'd':
+            oldbstfname = optarg;
+            break;
+
          case '4':
             if (only6Flag)
                goto arg_err;
@@ -149,6 +1264,22 @@ int main(int argc, char *argv[])
             only6Flag = true;
             break;
 
+         case 'w':
+            if ((workers = (int32_t)strtol(optarg, NULL, 10)) < 1 || maxWorkers < workers)
+            {
+               lastopt = optarg;
+               goto arg_err;
+            }
+            break;
+
+         case 'b':
+            batchFlag = true;
+            break;
+
+         case 's':
+            serverName = optarg;
+            break;
+
          case 'q':
             if (!optarg | strvlen(optarg) < 2)
             {
@@ -159,6 +1290,14 @@ int main(int argc, char *argv[])
             printf("%s encodes to %u\n", optarg, ccv(*(uint16_t *)optarg, 0));
             return 0;
 
+         case 'e':
+            if (!parseLookupEngines(optarg, &ip4engine, &ip6engine))
+            {
+               lastopt = optarg;
+               goto arg_err;
+            }
+            break;
+
          case 'r':
             bstfname = optarg;
             break;
@@ -176,7 +1315,15 @@ int main(int argc, char *argv[])
    argc -= optind;
    argv += optind;
 
-   if (argc != 1 && !ccList)
+   if (workers < 1)
+      workers = 1;
+   else if (workers > maxWorkers)
+      workers = maxWorkers;
+
+   if (serverName && (batchFlag || ccList || argc != 0)
+    || batchFlag && (ccList || argc > 1)
+    || oldbstfname && !ccList
+    || !serverName && !batchFlag && argc != 1 && !ccList)
    {
       printf("Wrong number of arguments:\n %s, ...\n\n", argv[0]);
       usage(cmd);
@@ -184,17 +1331,66 @@ int main(int argc, char *argv[])
    }
 
 
-   int    namelen = strvlen(bstfname);
-   char  *inName  = strcpy(alloca(namelen+4), bstfname);
-   FILE  *in;
-   struct stat st;
+   int    namelen = strvlen(bstfname),
+          oldlen  = (oldbstfname) ? strvlen(oldbstfname) : 0;
+   char  *inName  = strcpy(alloca(namelen+4), bstfname),
+         *oldName = (oldbstfname) ? strcpy(alloca(oldlen+4), oldbstfname) : NULL;
+   void  *oldSets = NULL;
+   size_t size, oldSize;
 
    rc = 1;
 
+//
+// fourth and fifth usage form -- lookup the country codes for the IP addresses in the lines of a file or of stdin,
+// or for the IP addresses in the requests at the server socket
+//
+   if (batchFlag || serverName)
+   {
+      IP4Table *ip4table;
+      IP6Table *ip6table;
+      FILE     *in = (serverName || argc == 0 || strcmp(argv[0], "-") == 0) ? stdin : fopen(argv[0], "r");
+
+      *(uint32_t *)&inName[namelen] = *(uint32_t *)".v4";
+      if (!in)
+         printf("The input file could not be opened.\n\n");
+
+      else if (!(ip4table = loadIP4Table(inName, ip4engine, residentAccess)))
+         printf("IPv4 database file could not be loaded.\n\n");
+
+      else
+      {
+         *(uint32_t *)&inName[namelen] = *(uint32_t *)".v6";
+         if (!(ip6table = loadIP6Table(inName, ip6engine, residentAccess)))
+            printf("IPv6 database file could not be loaded.\n\n");
+
+         else
+         {
+            if (serverName)
+            {
+               if (lookupServer(serverName, bstfname, ip4engine, ip6engine, &ip4table, &ip6table) == 0)
+                  rc = 0;                 // stopped by SIGINT or SIGTERM
+               else
+                  printf("The lookup server failed: %s\n\n", strerror(errno));
+            }
+            else if (batchLookup(in, ip4table, ip6table) >= 0)
+               rc = 0;
+            else
+               printf("Not enough memory for the batch lookups.\n\n");
+
+            releaseIP6Table(ip6table);
+         }
+
+         releaseIP4Table(ip4table);
+      }
+
+      if (in && in != stdin)
+         fclose(in);
+   }
+
 //
 // first usage form -- lookup the country code for a given IPv4 or IPv6 address
 //
-   if (ccList == NULL)
+   else if (ccList == NULL)
    {
       int      o;
       uint32_t ipv4;
@@ -202,63 +1398,43 @@ int main(int argc, char *argv[])
       if (ipv4 = ipv4_str2bin(argv[0]))
       {
          *(uint32_t *)&inName[namelen] = *(uint32_t *)".v4";
-         if (stat(inName, &st) == noerr && st.st_size && (in = fopen(inName, "r")))
+         IP4Table *table = loadIP4Table(inName, ip4engine, randomAccess);
+         if (table)
          {
             IP4Str ipstr_lo, ipstr_hi;
-            IP4Set *sortedIP4Sets = allocate((ssize_t)st.st_size, false);
-            if (sortedIP4Sets)
-            {
-               if (fread(sortedIP4Sets, (ssize_t)st.st_size, 1, in))
-               {
-                  if ((o = bisectionIP4Search(ipv4, sortedIP4Sets, (int)(st.st_size/sizeof(IP4Set)))) >= 0)
-                     printf("%s in %s - %s in %s\n\n", argv[0], ipv4_bin2str(sortedIP4Sets[o][0], ipstr_lo), ipv4_bin2str(sortedIP4Sets[o][1], ipstr_hi), (char *)&sortedIP4Sets[o][2]);
-                  else
-                     printf("%s not found.\n\n", argv[0]);
-                  rc = 0;
-               }
-               else
-                  printf("IPv4 database file could not be loaded.\n\n");
-
-               deallocate(VPR(sortedIP4Sets), false);
-            }
+            if ((o = tableIP4Search(ipv4, table)) >= 0)
+               printf("%s in %s - %s in %s\n\n", argv[0], ipv4_bin2str(table->sets[o][0], ipstr_lo), ipv4_bin2str(table->sets[o][1], ipstr_hi), (char *)&table->sets[o][2]);
             else
-               printf("Not enough memory for loading the IPv4 database.\n\n");
+               printf("%s not found.\n\n", argv[0]);
+            rc = 0;
 
-            fclose(in);
+            releaseIP4Table(table);
          }
-         else
+         else if (errno == ENOENT)
             printf("IPv4 database file could not be found.\n\n");
+         else
+            printf("IPv4 database file could not be loaded.\n\n");
       }
 
       else if (gt_u128(ipv6 = ipv6_str2bin(argv[0]), u64_to_u128t(0)))
       {
          *(uint32_t *)&inName[namelen] = *(uint32_t *)".v6";
-         if (stat(inName, &st) == noerr && st.st_size && (in = fopen(inName, "r")))
+         IP6Table *table = loadIP6Table(inName, ip6engine, randomAccess);
+         if (table)
          {
             IP6Str ipstr_lo, ipstr_hi;
-            IP6Set *sortedIP6Sets = allocate((ssize_t)st.st_size, false);
-            if (sortedIP6Sets)
-            {
-               if (fread(sortedIP6Sets, (ssize_t)st.st_size, 1, in))
-               {
-                  if ((o = bisectionIP6Search(ipv6, sortedIP6Sets, (int)(st.st_size/sizeof(IP6Set)))) >= 0)
-                     printf("%s in %s - %s in %s\n\n", argv[0], ipv6_bin2str(sortedIP6Sets[o][0], ipstr_lo), ipv6_bin2str(sortedIP6Sets[o][1], ipstr_hi), (char *)&sortedIP6Sets[o][2]);
-                  else
-                     printf("%s not found.\n\n", argv[0]);
-                  rc = 0;
-               }
-               else
-                  printf("IPv6 database file could not be loaded.\n\n");
-
-               deallocate(VPR(sortedIP6Sets), false);
-            }
+            if ((o = tableIP6Search(ipv6, table)) >= 0)
+               printf("%s in %s - %s in %s\n\n", argv[0], ipv6_bin2str(table->sets[o][0], ipstr_lo), ipv6_bin2str(table->sets[o][1], ipstr_hi), (char *)&table->sets[o][2]);
             else
-               printf("Not enough memory for loading the IPv6 database.\n\n");
+               printf("%s not found.\n\n", argv[0]);
+            rc = 0;
 
-            fclose(in);
+            releaseIP6Table(table);
          }
-         else
+         else if (errno == ENOENT)
             printf("IPv6 database file could not be found.\n\n");
+         else
+            printf("IPv6 database file could not be loaded.\n\n");
       }
 
       else
@@ -273,7 +1449,7 @@ int main(int argc, char *argv[])
    {
       if (CCTable = createCCTable())
       {
-         int count = 0;
+         int count = 0, lines;
          char *ccui = ccList;
          while (*ccui)
          {
@@ -284,66 +1460,47 @@ int main(int argc, char *argv[])
             ccui += tl;
          }
 
+         Generator gen = {.ccList = ccList, .plainFlag = plainFlag, .ccValFlag = ccValFlag, .aggregate = aggrFlag, .tval = tval, .toff = toff,
+                          .lock = PTHREAD_MUTEX_INITIALIZER, .formatted = PTHREAD_COND_INITIALIZER, .freed = PTHREAD_COND_INITIALIZER};
+         if (!plainFlag)
+         {
+            gen.prefixlen    = snprintf(gen.prefix, sizeof(gen.prefix), "table %d add ", tnum);
+            gen.delPrefixlen = snprintf(gen.delPrefix, sizeof(gen.delPrefix), "table %d delete ", tnum);
+         }
+         else if (oldName)
+         {
+            gen.prefixlen    = snprintf(gen.prefix, sizeof(gen.prefix), "add ");
+            gen.delPrefixlen = snprintf(gen.delPrefix, sizeof(gen.delPrefix), "delete ");
+         }
+         initOctetStrings();
+
       //
       // IPv4 table generation
       //
          if (!only6Flag)
          {
             *(uint32_t *)&inName[namelen] = *(uint32_t *)".v4";
-            if (stat(inName, &st) == noerr && st.st_size && (in = fopen(inName, "r")))
+            if (oldName)
+               *(uint32_t *)&oldName[oldlen] = *(uint32_t *)".v4";
+            if (gen.sets = mapSortedTable(inName, sequentialAccess, &size))
             {
-               CCNode *ccn = NULL;
-               IP4Str  ipstr;
-               IP4Set *sortedIP4Sets = allocate((ssize_t)st.st_size, false);
-               if (sortedIP4Sets)
-               {
-                  if (fread(sortedIP4Sets, (ssize_t)st.st_size, 1, in))
-                  {
-                     int i, n = (int)(st.st_size/sizeof(IP4Set));
-                     for (i = 0; i < n; i++)
-                     {
-                        if (!*ccList || (ccn = findCC(CCTable, sortedIP4Sets[i][2])))
-                        {
-                           uint32_t ip = sortedIP4Sets[i][0];
-                           uint32_t ui = (ccn) ? ccn->ui : 0;
-                           int32_t  m;
-                           do
-                           {
-                              m = intlb4_1p(sortedIP4Sets[i][1] - ip);
-                              while (ip - (ip >> m << m))
-                                 m--;
-
-                              if (plainFlag)
-                                 printf("%s/%d\n", ipv4_bin2str(ip, ipstr), 32 - m);
-                              else if (ui != 0)
-                                 printf("table %d add %s/%d %u\n", tnum, ipv4_bin2str(ip, ipstr), 32 - m, ui);
-                              else if (tval != 0)
-                                 printf("table %d add %s/%d %u\n", tnum, ipv4_bin2str(ip, ipstr), 32 - m, tval);
-                              else if (ccValFlag)
-                                 printf("table %d add %s/%d %u\n", tnum, ipv4_bin2str(ip, ipstr), 32 - m, ccv((uint16_t)sortedIP4Sets[i][2], toff));
-                              else
-                                 printf("table %d add %s/%d\n",    tnum, ipv4_bin2str(ip, ipstr), 32 - m);
-
-                              count++;
-                           }
-                           while ((ip += (uint32_t)1<<m) < sortedIP4Sets[i][1]);
-                        }
-                     }
-
-                     rc = 0;
-                  }
-                  else
-                     printf("IPv4 database file could not be loaded.\n\n");
-
-                  deallocate(VPR(sortedIP4Sets), false);
-               }
+               gen.count = (int)(size/sizeof(IP4Set));
+               gen.ip6   = false;
+               if (oldName && !(oldSets = mapSortedTable(oldName, sequentialAccess, &oldSize)))
+                  printf("Previous IPv4 database file could not be loaded.\n\n");
+               else if ((lines = (oldName) ? diffTables(&gen, oldSets, (int)(oldSize/sizeof(IP4Set))) : generateTable(&gen, workers)) >= 0)
+                  count += lines, rc = 0;
                else
-                  printf("Not enough memory for loading the IPv4 database.\n\n");
+                  printf("Not enough memory.\n\n");
 
-               fclose(in);
+               if (oldSets)
+                  unmapSortedTable(oldSets, oldSize), oldSets = NULL;
+               unmapSortedTable(gen.sets, size);
             }
-            else
+            else if (errno == ENOENT)
                printf("IPv4 database file could not be found.\n\n");
+            else
+               printf("IPv4 database file could not be loaded.\n\n");
          }
 
       //
@@ -352,60 +1509,27 @@ int main(int argc, char *argv[])
          if (!only4Flag)
          {
             *(uint32_t *)&inName[namelen] = *(uint32_t *)".v6";
-            if (stat(inName, &st) == noerr && st.st_size && (in = fopen(inName, "r")))
+            if (oldName)
+               *(uint32_t *)&oldName[oldlen] = *(uint32_t *)".v6";
+            if (gen.sets = mapSortedTable(inName, sequentialAccess, &size))
             {
-               CCNode *ccn = NULL;
-               IP6Str  ipstr;
-               IP6Set *sortedIP6Sets = allocate((ssize_t)st.st_size, false);
-               if (sortedIP6Sets)
-               {
-                  if (fread(sortedIP6Sets, (ssize_t)st.st_size, 1, in))
-                  {
-                     int i, n = (int)(st.st_size/sizeof(IP6Set));
-                     for (i = 0; i < n; i++)
-                     {
-                        if (!*ccList || (ccn = findCC(CCTable, *(uint32_t*)&sortedIP6Sets[i][2])))
-                        {
-                           uint128t ip = sortedIP6Sets[i][0];
-                           uint32_t ui = (ccn) ? ccn->ui : 0;
-                           int32_t  m;
-                           do
-                           {
-                              m = intlb6_1p(sub_u128(sortedIP6Sets[i][1], ip));
-                              while (gt_u128(sub_u128(ip, shl_u128(shr_u128(ip, m), m)), u64_to_u128t(0)))
-                                 m--;
-
-                              if (plainFlag)
-                                 printf("%s/%d\n", ipv6_bin2str(ip, ipstr), 128 - m);
-                              else if (ui != 0)
-                                 printf("table %d add %s/%d %u\n", tnum, ipv6_bin2str(ip, ipstr), 128 - m, ui);
-                              else if (tval != 0)
-                                 printf("table %d add %s/%d %u\n", tnum, ipv6_bin2str(ip, ipstr), 128 - m, tval);
-                              else if (ccValFlag)
-                                 printf("table %d add %s/%d %u\n", tnum, ipv6_bin2str(ip, ipstr), 128 - m, ccv(*(uint16_t*)&sortedIP6Sets[i][2], toff));
-                              else
-                                 printf("table %d add %s/%d\n",    tnum, ipv6_bin2str(ip, ipstr), 128 - m);
-
-                              count++;
-                           }
-                           while (lt_u128(ip = add_u128(ip, shl_u128(u64_to_u128t(1), m)), sortedIP6Sets[i][1]));
-                        }
-                     }
-
-                     rc = 0;
-                  }
-                  else
-                     printf("IPv6 database file could not be loaded.\n\n");
-
-                  deallocate(VPR(sortedIP6Sets), false);
-               }
+               gen.count = (int)(size/sizeof(IP6Set));
+               gen.ip6   = true;
+               if (oldName && !(oldSets = mapSortedTable(oldName, sequentialAccess, &oldSize)))
+                  printf("Previous IPv6 database file could not be loaded.\n\n");
+               else if ((lines = (oldName) ? diffTables(&gen, oldSets, (int)(oldSize/sizeof(IP6Set))) : generateTable(&gen, workers)) >= 0)
+                  count += lines, rc = 0;
                else
-                  printf("Not enough memory for loading the IPv6 database.\n\n");
+                  printf("Not enough memory.\n\n");
 
-               fclose(in);
+               if (oldSets)
+                  unmapSortedTable(oldSets, oldSize), oldSets = NULL;
+               unmapSortedTable(gen.sets, size);
             }
-            else
+            else if (errno == ENOENT)
                printf("IPv6 database file could not be found.\n\n");
+            else
+               printf("IPv6 database file could not be loaded.\n\n");
          }
 
          if (!count)
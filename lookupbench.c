@@ -0,0 +1,210 @@
+//  lookupbench.c
+//  lookupbench
+//
+//  Created by Dr. Rolf Jansen on 2026-10-16.
+//  Copyright © 2026 projectworld.net. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification,
+//  are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS
+//  OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+//  AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER
+//  OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+//  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+//  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+//  IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+//  THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  make lookupbench
+//
+//  ./lookupbench /usr/local/etc/ipdb/IPRanges/ipcc.bst.v4
+//
+//  Compares the scalar bisection of the IPv4 table with the batched bisections, which on AVX2 capable machines use the
+//  8-lane gather kernel, and with the learned index, on the given table and on a synthetic one of about 10 times its size,
+//  derived from the given table by splitting each range into 10 parts.
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "binutils.h"
+#include "store.h"
+#include "testutils.h"
+
+
+#define lookups 10000000
+#define rounds  5
+
+static inline uint32_t random32(void)
+{
+   return (uint32_t)(xorshift() >> 16);
+}
+
+static inline double seconds(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+// Half of the addresses are random, the other half are hits in random ranges of the table.
+static void randomAddresses(uint32_t *ip4s, int n, IP4Set *sets, int count)
+{
+   for (int i = 0; i < n; i++)
+      if (i & 1)
+      {
+         uint32_t *set = sets[random32() % count];
+         ip4s[i] = set[0] + random32() % (set[1] - set[0] + 1);
+      }
+      else
+         ip4s[i] = random32();
+}
+
+static IP4Set *tenfoldTable(IP4Set *sets, int count, int *tenfold)
+{
+   IP4Set  *tens = malloc(10*count*sizeof(IP4Set));
+   uint32_t lo, step;
+   int      i, k, n;
+
+   for (n = i = 0; i < count; i++)
+      if ((step = (sets[i][1] - sets[i][0])/10) == 0)
+      {
+         memcpy(tens[n++], sets[i], sizeof(IP4Set));
+      }
+      else
+         for (lo = sets[i][0], k = 0; k < 10; k++, n++, lo += step)
+         {
+            tens[n][0] = lo;
+            tens[n][1] = (k < 9) ? lo + step - 1 : sets[i][1];
+            tens[n][2] = sets[i][2];
+         }
+
+   *tenfold = n;
+   return tens;
+}
+
+static void benchmark(const char *name, IP4Set *sets, int count, uint32_t *ip4s, int *indexes)
+{
+   double t, scalar = 1e9, batched = 1e9;
+   long   sum = 0, misses = 0;
+   int    i, r;
+
+   for (r = 0; r < rounds; r++)
+   {
+      t = seconds();
+      for (i = 0; i < lookups; i++)
+         sum += indexes[i] = bisectionIP4Search(ip4s[i], sets, count);
+      if ((t = seconds() - t) < scalar)
+         scalar = t;
+
+      t = seconds();
+      bisectionIP4SearchBatch(ip4s, indexes, lookups, sets, count);
+      if ((t = seconds() - t) < batched)
+         batched = t;
+   }
+
+   for (i = 0; i < lookups; i++)
+      if (indexes[i] != bisectionIP4Search(ip4s[i], sets, count))
+         misses++;
+
+   printf("%-9s %8d ranges, %7.1f MB:   scalar %6.1f ns   batched %6.1f ns   speedup %4.1f   %s (%ld)\n",
+          name, count, count*sizeof(IP4Set)/1048576.0, scalar/lookups*1e9, batched/lookups*1e9, scalar/batched,
+          (misses) ? "MISMATCH" : "ok", sum & 1);
+}
+
+static void learned(const char *name, IP4Set *sets, int count, uint32_t *ip4s, int *indexes)
+{
+   LearnedIP4 *model;
+   void  *block = NULL;
+   double t, bisect = 1e9, predict = 1e9;
+   long   sum = 0, misses = 0;
+   int    i, r;
+
+   if (!(model = learnedIP4Segments(sets, count, &block)))
+      return;
+
+   for (r = 0; r < rounds; r++)
+   {
+      t = seconds();
+      for (i = 0; i < lookups; i++)
+         sum += bisectionIP4Search(ip4s[i], sets, count);
+      if ((t = seconds() - t) < bisect)
+         bisect = t;
+
+      t = seconds();
+      for (i = 0; i < lookups; i++)
+         sum += indexes[i] = learnedIP4Search(ip4s[i], model, sets, count);
+      if ((t = seconds() - t) < predict)
+         predict = t;
+   }
+
+   for (i = 0; i < lookups; i++)
+      if (indexes[i] != bisectionIP4Search(ip4s[i], sets, count))
+         misses++;
+
+   printf("%-9s %8d segments, %7.1f kB, max. error %d:   bisection %6.1f ns   learned %6.1f ns   %s (%ld)\n",
+          name, model->segments, (sizeof(LearnedIP4) + (model->segments + 1)*sizeof(LearnedSegment))/1024.0, model->maxError,
+          bisect/lookups*1e9, predict/lookups*1e9, (misses) ? "MISMATCH" : "ok", sum & 1);
+
+   deallocate(&block, false);
+}
+
+int main(int argc, const char *argv[])
+{
+   IP4Table *table;
+   IP4Set   *tens;
+   uint32_t *ip4s;
+   int      *indexes, tenfold;
+
+   if (argc != 2)
+   {
+      printf("Usage: %s <bstfile.v4>\n", argv[0]);
+      return 1;
+   }
+
+   if (!(table = loadIP4Table((char *)argv[1], bisectionEngine, residentAccess)) || table->count == 0)
+   {
+      printf("IPv4 database file could not be loaded.\n");
+      return 1;
+   }
+
+#if defined(__x86_64__)
+   printf("AVX2 kernel: %s\n\n", (__builtin_cpu_supports("avx2")) ? "yes" : "no, scalar fallback");
+#endif
+
+   ip4s    = malloc(lookups*sizeof(uint32_t));
+   indexes = malloc(lookups*sizeof(int));
+
+   tens = tenfoldTable(table->sets, table->count, &tenfold);
+
+   printf("Scalar versus batched bisections:\n");
+   randomAddresses(ip4s, lookups, table->sets, table->count);
+   benchmark("table", table->sets, table->count, ip4s, indexes);
+   randomAddresses(ip4s, lookups, tens, tenfold);
+   benchmark("10x table", tens, tenfold, ip4s, indexes);
+
+   printf("\nBisection versus learned index:\n");
+   randomAddresses(ip4s, lookups, table->sets, table->count);
+   learned("table", table->sets, table->count, ip4s, indexes);
+   randomAddresses(ip4s, lookups, tens, tenfold);
+   learned("10x table", tens, tenfold, ip4s, indexes);
+
+   free(tens);
+   free(indexes);
+   free(ip4s);
+   releaseIP4Table(table);
+   return 0;
+}
@@ -29,7 +29,13 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <math.h>
+#include <float.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "binutils.h"
 #include "store.h"
@@ -691,355 +697,1223 @@ void releaseIP6Tree(IP6Node *node)
 }
 
 
-#pragma mark ••• AVL Tree of Country Codes •••
+#pragma mark ••• Sort and Sweep Build of the IP-Ranges •••
 
-static int balanceCCNode(CCNode **node)
+// The records of each RIR file come almost sorted, and many bytes of their lower bounds are the same in all records,
+// e.g. the low bytes of the aligned IPv6 prefixes. So, the sort is skipped if the records are sorted already, and
+// the LSD radix sort skips the passes over the bytes which are the same in all records. The byte counts of all the
+// passes are taken in one go, and the passes are stable, so that records with the same lower bound keep their order.
+
+static bool radixSortIP4Records(IP4Record *records, int count)
 {
-   int   change = 0;
-   CCNode *o = *node;
-   CCNode *p, *q;
+   IP4Record *a = records, *b, *t, *scratch;
+   int        d, i, k, sum, counts[4][256] = {};
+   bool       sorted = true;
 
-   if (o->B == -2)
+   for (i = 0; i < count; i++)
    {
-      if (p = o->L)                    // make the static analyzer happy
-         if (p->B == +1)
-         {
-            change = 1;                // double left-right rotation
-            q      = p->R;             // left rotation
-            p->R   = q->L;
-            q->L   = p;
-            o->L   = q->R;             // right rotation
-            q->R   = o;
-            o->B   = +(q->B < 0);
-            p->B   = -(q->B > 0);
-            q->B   = 0;
-            *node  = q;
-         }
-
-         else
-         {
-            change = p->B;             // single right rotation
-            o->L   = p->R;
-            p->R   = o;
-            o->B   = -(++p->B);
-            *node  = p;
-         }
+      uint32_t lo = records[i].lo;
+      for (d = 0; d < 4; d++)
+         counts[d][lo >> 8*d & 0xFF]++;
+      if (i && lo < records[i-1].lo)
+         sorted = false;
    }
 
-   else if (o->B == +2)
+   if (sorted)
+      return true;
+
+   if (!(b = scratch = allocate(count*sizeof(IP4Record), false)))
+      return false;
+
+   for (d = 0; d < 4; d++)
    {
-      if (q = o->R)                    // make the static analyzer happy
-         if (q->B == -1)
-         {
-            change = 1;                // double right-left rotation
-            p      = q->L;             // right rotation
-            q->L   = p->R;
-            p->R   = q;
-            o->R   = p->L;             // left rotation
-            p->L   = o;
-            o->B   = -(p->B > 0);
-            q->B   = +(p->B < 0);
-            p->B   = 0;
-            *node  = p;
-         }
+      int *c = counts[d];
+      if (c[records[0].lo >> 8*d & 0xFF] == count)
+         continue;
 
-         else
-         {
-            change = q->B;             // single left rotation
-            o->R   = q->L;
-            q->L   = o;
-            o->B   = -(--q->B);
-            *node  = q;
-         }
+      for (sum = k = 0; k < 256; k++)
+         sum += c[k], c[k] = sum - c[k];
+
+      for (i = 0; i < count; i++)
+         b[c[a[i].lo >> 8*d & 0xFF]++] = a[i];
+      t = a, a = b, b = t;
    }
 
-   return change != 0;
+   if (a != records)
+      memcpy(records, a, count*sizeof(IP4Record));
+   deallocate(VPR(scratch), false);
+   return true;
 }
 
+static inline uint32_t ip6Byte(uint128t ip, int d)
+{
+   IP6Desc desc = {.number = ip};
+   return desc.quad[(d < 8) ? b2_0 : b2_1] >> 8*(d & 7) & 0xFF;
+}
 
-static int pickPrevCCNode(CCNode **node, CCNode **exch)
-{                                             // *exch on entry = parent node
-   CCNode *o = *node;                         // *exch on exit  = picked previous value node
+static bool radixSortIP6Records(IP6Record *records, int count)
+{
+   IP6Record *a = records, *b, *t, *scratch;
+   int        d, i, k, sum, counts[16][256] = {};
+   bool       sorted = true;
 
-   if (o->R)
+   for (i = 0; i < count; i++)
    {
-      *exch = o;
-      int change = -pickPrevCCNode(&o->R, exch);
-      if (change)
-         if (abs(o->B += change) > 1)
-            return balanceCCNode(node);
-         else
-            return o->B == 0;
-      else
-         return 0;
+      uint128t lo = records[i].lo;
+      for (d = 0; d < 16; d++)
+         counts[d][ip6Byte(lo, d)]++;
+      if (i && lt_u128(lo, records[i-1].lo))
+         sorted = false;
    }
 
-   else if (o->L)
-   {
-      CCNode *p = o->L;
-      o->L = NULL;
-      (*exch)->R = p;
-      *exch = o;
-      return p->B == 0;
-   }
+   if (sorted)
+      return true;
 
-   else
+   if (!(b = scratch = allocate(count*sizeof(IP6Record), false)))
+      return false;
+
+   for (d = 0; d < 16; d++)
    {
-      (*exch)->R = NULL;
-      *exch = o;
-      return 1;
+      int *c = counts[d];
+      if (c[ip6Byte(records[0].lo, d)] == count)
+         continue;
+
+      for (sum = k = 0; k < 256; k++)
+         sum += c[k], c[k] = sum - c[k];
+
+      for (i = 0; i < count; i++)
+         b[c[ip6Byte(a[i].lo, d)]++] = a[i];
+      t = a, a = b, b = t;
    }
+
+   if (a != records)
+      memcpy(records, a, count*sizeof(IP6Record));
+   deallocate(VPR(scratch), false);
+   return true;
 }
 
+static int compareIP4Sequence(const void *a, const void *b)
+{
+   uint32_t s = ((IP4Record *)a)->seq, t = ((IP4Record *)b)->seq;
+   return (s > t) - (s < t);
+}
 
-static int pickNextCCNode(CCNode **node, CCNode **exch)
-{                                             // *exch on entry = parent node
-   CCNode *o = *node;                         // *exch on exit  = picked next value node
+static int compareIP6Sequence(const void *a, const void *b)
+{
+   uint32_t s = ((IP6Record *)a)->seq, t = ((IP6Record *)b)->seq;
+   return (s > t) - (s < t);
+}
 
-   if (o->L)
+// Merge a range into the AVL tree, whereby it absorbs the overlapping nodes and the touching nodes of the same country.
+static void mergeIP4Range(uint32_t lo, uint32_t hi, uint32_t cc, IP4Node **tree)
+{
+   IP4Node *node;
+   while (node = findNet4Node(lo, hi, cc, *tree))
    {
-      *exch = o;
-      int change = +pickNextCCNode(&o->L, exch);
-      if (change)
-         if (abs(o->B += change) > 1)
-            return balanceCCNode(node);
-         else
-            return o->B == 0;
-      else
-         return 0;
-   }
+      if (node->lo < lo)
+         lo = node->lo;
 
-   else if (o->R)
-   {
-      CCNode *q = o->R;
-      o->R = NULL;
-      (*exch)->L = q;
-      *exch = o;
-      return q->B == 0;
+      if (node->hi > hi)
+         hi = node->hi;
+
+      removeIP4Node(node->lo, tree);
    }
 
-   else
+   addIP4Node(lo, hi, cc, tree);
+}
+
+static void mergeIP6Range(uint128t lo, uint128t hi, uint32_t cc, IP6Node **tree)
+{
+   IP6Node *node;
+   while (node = findNet6Node(lo, hi, cc, *tree))
    {
-      (*exch)->L = NULL;
-      *exch = o;
-      return 1;
+      if (lt_u128(node->lo, lo))
+         lo = node->lo;
+
+      if (gt_u128(node->hi, hi))
+         hi = node->hi;
+
+      removeIP6Node(node->lo, tree);
    }
-}
 
+   addIP6Node(lo, hi, cc, tree);
+}
 
-CCNode *findCCNode(uint32_t cc, CCNode *node)
+static int flattenIP4Tree(IP4Node *node, IP4Set *sets, int n)
 {
    if (node)
    {
-      if (cc < node->cc)
-         return findCCNode(cc, node->L);
+      n = flattenIP4Tree(node->L, sets, n);
+      sets[n][0] = node->lo, sets[n][1] = node->hi, sets[n][2] = node->cc, n++;
+      n = flattenIP4Tree(node->R, sets, n);
+   }
 
-      else if (cc > node->cc)
-         return findCCNode(cc, node->R);
+   return n;
+}
 
-      else // (cc == node->cc)
-         return node;
+static int flattenIP6Tree(IP6Node *node, IP6Set *sets, int n)
+{
+   if (node)
+   {
+      n = flattenIP6Tree(node->L, sets, n);
+      sets[n][0] = node->lo, sets[n][1] = node->hi, sets[n][2] = u64_to_u128t(node->cc), n++;
+      n = flattenIP6Tree(node->R, sets, n);
    }
-   else
-      return NULL;
-}
 
+   return n;
+}
 
-int addCCNode(uint32_t cc, uint32_t ui, CCNode **node)
+// Only the records of a chain of overlapping or touching ranges can be merged with each other. If none of them
+// overlap, the result does not depend on their order, and the touching ranges of the same country are joined.
+// Otherwise, the later of two overlapping records determines the country of the merged range, and so the chain is
+// merged in the order of the sequence numbers by the AVL tree. This is rare, and the chains are short.
+//
+// The fresh tree of a chain has another shape than the global tree of the former build, but the result does not
+// depend on the shape. The nodes are disjoint, and findNet4/6Node() returns a node which overlaps the range or
+// touches it with the same country, whenever there is one, because if a node does not qualify and the range lies
+// left of it, then all the qualifying nodes do so, too, and the same for the right. Absorbing a node only widens
+// the range, and so the merge ends with the same range and the same remaining nodes, whatever the order in which
+// the qualifying nodes were found. Ranges of different chains are separated by at least one address and never
+// qualify for each other. This is cross checked by sweeptest.c.
+
+int sweepIP4Records(IP4Record *records, int count, IP4Set *sets)
 {
-   CCNode *o = *node;
-
-   if (o != NULL)
-   {
-      int change;
+   int i, j, k, n = 0;
 
-      if (cc < o->cc)
-         change = -addCCNode(cc, ui, &o->L);
+   if (!radixSortIP4Records(records, count))
+      return -1;
 
-      else if (cc > o->cc)
-         change = +addCCNode(cc, ui, &o->R);
+   for (i = 0; i < count; i = j)
+   {
+      uint32_t hi = records[i].hi;
+      bool     overlap = false;
+      for (j = i + 1; j < count && (hi == UINT32_MAX || records[j].lo <= hi + 1); j++)
+      {
+         if (records[j].lo <= hi)
+            overlap = true;
+         if (records[j].hi > hi)
+            hi = records[j].hi;
+      }
 
-      else // (cc == o->cc)               // already in the list, do nothing
-         return 0;
+      if (!overlap)
+         for (k = i; k < j; k++)
+            if (k > i && records[k].cc == sets[n-1][2])
+               sets[n-1][1] = records[k].hi;
+            else
+               sets[n][0] = records[k].lo, sets[n][1] = records[k].hi, sets[n][2] = records[k].cc, n++;
 
-      if (change)
-         if (abs(o->B += change) > 1)
-            return 1 - balanceCCNode(node);
-         else
-            return o->B != 0;
       else
-         return 0;
-   }
-
-   else // (o == NULL)                    // if the CCNode is not in the tree
-   {                                      // then add it into a new leaf
-      if (o = allocate(sizeof(CCNode), true))
       {
-         o->cc = cc;
-         o->ui = ui;
-         *node = o;                       // report back the new node
-         return 1;                        // add the weight of 1 leaf onto the balance
+         IP4Node *tree = NULL;
+         qsort(&records[i], j - i, sizeof(IP4Record), compareIP4Sequence);
+         for (k = i; k < j; k++)
+            mergeIP4Range(records[k].lo, records[k].hi, records[k].cc, &tree);
+         n = flattenIP4Tree(tree, sets, n);
+         releaseIP4Tree(tree);
       }
-
-      return 0;                           // Out of Memory situation, nothing changed
    }
-}
 
+   return n;
+}
 
-int removeCCNode(uint32_t cc, CCNode **node)
+int sweepIP6Records(IP6Record *records, int count, IP6Set *sets)
 {
-   CCNode *o = *node;
+   int i, j, k, n = 0;
+   uint128t one = u64_to_u128t(1), ones = sub_u128(u64_to_u128t(0), one);
 
-   if (o != NULL)
-   {
-      int change;
+   if (!radixSortIP6Records(records, count))
+      return -1;
 
-      if (cc < o->cc)
-         change = +removeCCNode(cc, &o->L);
+   for (i = 0; i < count; i = j)
+   {
+      uint128t hi = records[i].hi;
+      bool     overlap = false;
+      for (j = i + 1; j < count && (eq_u128(hi, ones) || le_u128(records[j].lo, add_u128(hi, one))); j++)
+      {
+         if (le_u128(records[j].lo, hi))
+            overlap = true;
+         if (gt_u128(records[j].hi, hi))
+            hi = records[j].hi;
+      }
 
-      else if (cc > o->cc)
-         change = -removeCCNode(cc, &o->R);
+      if (!overlap)
+         for (k = i; k < j; k++)
+            if (k > i && eq_u128(u64_to_u128t(records[k].cc), sets[n-1][2]))
+               sets[n-1][1] = records[k].hi;
+            else
+               sets[n][0] = records[k].lo, sets[n][1] = records[k].hi, sets[n][2] = u64_to_u128t(records[k].cc), n++;
 
-      else // (cc == o->cc)
+      else
       {
-         int     b = o->B;
-         CCNode *p = o->L;
-         CCNode *q = o->R;
+         IP6Node *tree = NULL;
+         qsort(&records[i], j - i, sizeof(IP6Record), compareIP6Sequence);
+         for (k = i; k < j; k++)
+            mergeIP6Range(records[k].lo, records[k].hi, records[k].cc, &tree);
+         n = flattenIP6Tree(tree, sets, n);
+         releaseIP6Tree(tree);
+      }
+   }
 
-         if (!p || !q)
-         {
-            deallocate(VPR(*node), false);
-            *node = (p > q) ? p : q;
-            return 1;                     // remove the weight of 1 leaf from the balance
-         }
+   return n;
+}
 
-         else
+#pragma mark ••• Memory Mapped Binary Sorted Tables •••
+
+void *mapSortedTable(const char *fname, TableAccess access, size_t *size)
+{
+   int    fd;
+   void  *table = NULL;
+   struct stat st;
+
+   if ((fd = open(fname, O_RDONLY)) >= 0)
+   {
+      if (fstat(fd, &st) == noerr)
+      {
+         if (st.st_size)
          {
-            if (b == -1)
+            int flags = MAP_SHARED;
+         #if defined(MAP_POPULATE)
+            if (access == residentAccess)
+               flags |= MAP_POPULATE;
+         #elif defined(MAP_PREFAULT_READ)
+            if (access == residentAccess)
+               flags |= MAP_PREFAULT_READ;
+         #endif
+
+            if ((table = mmap(NULL, (size_t)st.st_size, PROT_READ, flags, fd, 0)) != MAP_FAILED)
             {
-               if (!p->R)
-               {
-                  change = +1;
-                  o      =  p;
-                  o->R   =  q;
-               }
-               else
+               switch (access)
                {
-                  change = +pickPrevCCNode(&p, &o);
-                  o->L   =  p;
-                  o->R   =  q;
-               }
-            }
+                  case randomAccess:
+                     madvise(table, (size_t)st.st_size, MADV_RANDOM);
+                     break;
 
-            else
-            {
-               if (!q->L)
-               {
-                  change = -1;
-                  o      =  q;
-                  o->L   =  p;
-               }
-               else
-               {
-                  change = -pickNextCCNode(&q, &o);
-                  o->L   =  p;
-                  o->R   =  q;
+                  case sequentialAccess:
+                     madvise(table, (size_t)st.st_size, MADV_SEQUENTIAL);
+                     break;
+
+                  case residentAccess:
+                     madvise(table, (size_t)st.st_size, MADV_WILLNEED);
+                     break;
                }
-            }
 
-            o->B = b;
-            deallocate(VPR(*node), false);
-            *node = o;
+               *size = (size_t)st.st_size;
+            }
+            else
+               table = NULL;
          }
+         else
+            errno = ENOENT;               // an empty table is as good as no table
       }
 
-      if (change)
-         if (abs(o->B += change) > 1)
-            return balanceCCNode(node);
-         else
-            return o->B == 0;
-      else
-         return 0;
+      close(fd);
    }
 
-   else // (o == NULL)
-      return 0;                           // not found -> recursively do nothing
+   return table;
 }
 
-
-void releaseCCTree(CCNode *node)
+void unmapSortedTable(void *table, size_t size)
 {
-   if (node)
-   {
-      if (node->L)
-         releaseCCTree(node->L);
-
-      if (node->R)
-         releaseCCTree(node->R);
-
-      deallocate(VPR(node), false);
-   }
+   if (table)
+      munmap(table, size);
 }
 
 
-#pragma mark ••• Pseudo Hash Table of Country Codes •••
-
-
-// Table creation and release
-CCNode **createCCTable(void)
+// Allocation of the search structures of the lookup engines, whose nodes must be aligned to the cache lines.
+void *allocateAligned(ssize_t size, void **block)
 {
-   return allocate(ccTableSize*sizeof(CCNode *), true);
+   if (*block = allocate(size + 63, true))
+      return (void *)(((uintptr_t)*block + 63) & ~(uintptr_t)63);
+   else
+      return NULL;
 }
 
-void releaseCCTable(CCNode *table[])
+
+#pragma mark ••• Eytzinger Layout of the IP-Ranges •••
+
+static int eytzIP4(EytzIP4Key *keys, IP4Set *sortedIP4Sets, int count, int i, int k)
 {
-   if (table)
+   if (k <= count)
    {
-      for (uint32_t i = 0; i < ccTableSize; i++)
-         releaseCCTree(table[i]);
-      deallocate(VPR(table), false);
+      i = eytzIP4(keys, sortedIP4Sets, count, i, k << 1);
+      keys[k].lo = sortedIP4Sets[i][0];
+      keys[k].o  = i++;
+      i = eytzIP4(keys, sortedIP4Sets, count, i, (k << 1) + 1);
    }
+   return i;
 }
 
+EytzIP4Key *eytzingerIP4Keys(IP4Set *sortedIP4Sets, int count, void **block)
+{
+   EytzIP4Key *keys = allocateAligned((count + 1)*sizeof(EytzIP4Key), block);
+   if (keys)
+      eytzIP4(keys, sortedIP4Sets, count, 0, 1);
+   return keys;
+}
 
-// finding/storing/removing country codes
 
-static inline uint32_t cci(uint32_t cc)
+static int eytzIP6(EytzIP6Key *keys, IP6Set *sortedIP6Sets, int count, int i, int k)
 {
-   return (cc = cce((uint16_t)cc) < ccTableSize) ? cc : 0;  // the resulting index MUST FIT into the hash table
+   if (k <= count)
+   {
+      i = eytzIP6(keys, sortedIP6Sets, count, i, k << 1);
+      keys[k].lo = sortedIP6Sets[i][0];
+      keys[k].o  = i++;
+      i = eytzIP6(keys, sortedIP6Sets, count, i, (k << 1) + 1);
+   }
+   return i;
 }
 
-CCNode *findCC(CCNode *table[], uint32_t cc)
+EytzIP6Key *eytzingerIP6Keys(IP6Set *sortedIP6Sets, int count, void **block)
 {
-   return findCCNode(cc, table[cci(cc)]);
+   EytzIP6Key *keys = allocateAligned((count + 1)*sizeof(EytzIP6Key), block);
+   if (keys)
+      eytzIP6(keys, sortedIP6Sets, count, 0, 1);
+   return keys;
 }
 
-void storeCC(CCNode *table[], char *ccui)
+
+#pragma mark ••• Static B-Tree of the IPv4-Ranges •••
+
+STreeIP4 *sTreeIP4Keys(IP4Set *sortedIP4Sets, int count, void **block)
 {
-   int len = strvlen(ccui = trim(ccui));
-   if (len >= 2)
+   int32_t  levels, n, nodes, total = 0;
+   int32_t  valid[sTreeMaxLevels], size[sTreeMaxLevels];
+   STreeIP4 *tree;
+
+   for (levels = 0, n = count;; n = nodes)
    {
-      uint16_t cc;
-      int64_t  ui = 0;
-      cc = *(uint16_t *)uppercase(ccui, 2);
-      if (len > 2)
+      nodes = (n + sTreeB - 1)/sTreeB ?: 1;
+      valid[levels] = n;
+      total += size[levels++] = nodes*sTreeB;
+      if (nodes == 1)
+         break;
+   }
+
+   if (tree = allocateAligned(sizeof(STreeIP4) + total*sizeof(uint32_t), block))
+   {
+      int32_t i, l, o;
+      tree->levels = levels;
+      for (o = 0, l = levels - 1; l >= 0; o += size[l--])
       {
-         for (ccui += 2; *ccui && *ccui != '='; ccui++);
-         if (*ccui)
-            ui = strtol(ccui+1, NULL, 10);
+         tree->count[l]  = valid[l];
+         tree->offset[l] = o;
       }
 
-      addCCNode(cc, (0 < ui && ui < 4294967295) ? (uint32_t)ui : 0, &table[cci(cc)]);
+      uint32_t *keys = &tree->keys[tree->offset[0]];
+      for (i = 0; i < count; i++)
+         keys[i] = sortedIP4Sets[i][0] ^ 0x80000000;
+      for (; i < size[0]; i++)
+         keys[i] = 0x7FFFFFFF;                     // padding with the biased maximum
+
+      for (l = 1; l < levels; l++)
+      {
+         uint32_t *below = keys;
+         keys = &tree->keys[tree->offset[l]];
+         for (i = 0; i < valid[l]; i++)
+            keys[i] = below[i*sTreeB];
+         for (; i < size[l]; i++)
+            keys[i] = 0x7FFFFFFF;
+      }
    }
+
+   return tree;
 }
 
-void removeCC(CCNode *table[], uint32_t cc)
+
+#pragma mark ••• Direct Indexed Table of the IPv4-Ranges •••
+
+DirIP4 *dirIP4Slots(IP4Set *sortedIP4Sets, int count, int32_t bits, void **block)
 {
-   CCNode *node;
-   uint32_t idx = cci(cc);
-   if (node = table[idx])
-      if (!node->L && !node->R)
-         deallocate(VPR(table[idx]), false);
-      else
-         removeCCNode(cc, &table[idx]);
+   DirIP4 *dir;
+
+   if (count > dirMaxIndex || bits < 16 || 24 < bits)
+      return NULL;
+
+   if (dir = allocateAligned(sizeof(DirIP4) + ((size_t)1 << bits)*sizeof(uint32_t), block))
+   {
+      int32_t  i, j, shift = 32 - bits;
+      uint32_t s, n, lo, hi;
+
+      dir->bits = bits;
+      for (i = 0, s = 0; s < (uint32_t)1 << bits; s++)
+      {
+         lo = s << shift;
+         hi = lo | ((uint32_t)1 << shift) - 1;
+
+         while (i < count && sortedIP4Sets[i][1] < lo)
+            i++;
+
+         if (i == count || sortedIP4Sets[i][0] > hi)
+            dir->slots[s] = dirNone << 8;             // no range in this slot
+
+         else if (sortedIP4Sets[i][0] <= lo && hi <= sortedIP4Sets[i][1])
+            dir->slots[s] = (uint32_t)i << 8;         // one range covers the whole slot
+
+         else
+         {
+            for (j = i + 1; j < count && sortedIP4Sets[j][0] <= hi; j++)
+               ;
+            n = (uint32_t)(j - i);
+            dir->slots[s] = (uint32_t)i << 8 | ((n < dirMaxRun) ? n : dirMaxRun);
+         }
+      }
+   }
+
+   return dir;
+}
+
+
+#pragma mark ••• Learned Index of the IPv4-Ranges •••
+
+// Shrinking cone segmentation -- the cone [lower, upper] of the slopes, which keep the predicted positions of all the lower
+// bounds of a segment within learnedEpsilon, narrows with each range, and a new segment starts once it would become empty.
+// The segments are only counted if seg is NULL.
+static int learnedSegments(IP4Set *sortedIP4Sets, int count, LearnedSegment *seg)
+{
+   double dx, dy, lower, upper;
+   int    i, first, n;
+
+   for (n = 0, first = 0; first < count; n++, first = i)
+   {
+      for (lower = 0.0, upper = DBL_MAX, i = first + 1; i < count; i++)
+      {
+         dx = sortedIP4Sets[i][0] - sortedIP4Sets[first][0];
+         dy = i - first;
+         if ((dy + learnedEpsilon)/dx < lower || upper < (dy - learnedEpsilon)/dx)
+            break;
+
+         if (lower < (dy - learnedEpsilon)/dx)
+            lower = (dy - learnedEpsilon)/dx;
+         if (upper > (dy + learnedEpsilon)/dx)
+            upper = (dy + learnedEpsilon)/dx;
+      }
+
+      if (seg)
+         seg[n] = (LearnedSegment){sortedIP4Sets[first][0], first, (upper < DBL_MAX) ? (lower + upper)/2.0 : 0.0};
+   }
+
+   return n;
+}
+
+LearnedIP4 *learnedIP4Segments(IP4Set *sortedIP4Sets, int count, void **block)
+{
+   LearnedIP4 *model;
+   int segments = learnedSegments(sortedIP4Sets, count, NULL);
+
+   if (model = allocateAligned(sizeof(LearnedIP4) + (segments + 1)*sizeof(LearnedSegment), block))
+   {
+      int i, s, e;
+
+      model->segments = learnedSegments(sortedIP4Sets, count, model->seg);
+      model->seg[segments] = (LearnedSegment){UINT32_MAX, count, 0.0};
+
+      for (model->maxError = 0, s = 0; s < segments; s++)
+         for (i = model->seg[s].first; i < model->seg[s + 1].first; i++)
+         {
+            e = model->seg[s].first + (int)(model->seg[s].slope*(sortedIP4Sets[i][0] - model->seg[s].key)) - i;
+            if (model->maxError < abs(e))
+               model->maxError = abs(e);
+         }
+   }
+
+   return model;
+}
+
+
+#pragma mark ••• Multibit Trie of the IPv6-Ranges •••
+
+typedef struct
+{
+   PopNode *nodes;
+   int32_t *leaves;
+   uint32_t nodeCount, nodeSize;
+   uint32_t leafCount, leafSize;
+   IP6Set  *sets;
+   int      count;
+} PopTrieBuild;
+
+// Classify the slot [lo, hi] -- 0: no range, 1: covered by the range at *i, 2: shared by several ranges.
+static inline int popSlot(PopTrieBuild *b, uint128t lo, uint128t hi, int *i)
+{
+   while (*i < b->count && lt_u128(b->sets[*i][1], lo))
+      (*i)++;
+
+   if (*i == b->count || gt_u128(b->sets[*i][0], hi))
+      return 0;
+   else if (le_u128(b->sets[*i][0], lo) && le_u128(hi, b->sets[*i][1]))
+      return 1;
+   else
+      return 2;
+}
+
+static uint32_t popNodes(PopTrieBuild *b, uint32_t n)
+{
+   uint32_t first = b->nodeCount;
+   if ((b->nodeCount += n) > b->nodeSize)
+   {
+      b->nodeSize = b->nodeCount + (b->nodeCount >> 1) + 64;
+      if (!(b->nodes = reallocate(b->nodes, b->nodeSize*sizeof(PopNode), true, true)))
+         return UINT32_MAX;
+   }
+   return first;
+}
+
+static bool popLeaf(PopTrieBuild *b, int32_t leaf)
+{
+   if (b->leafCount == b->leafSize)
+   {
+      b->leafSize = b->leafCount + (b->leafCount >> 1) + 64;
+      if (!(b->leaves = reallocate(b->leaves, b->leafSize*sizeof(int32_t), false, true)))
+         return false;
+   }
+   b->leaves[b->leafCount++] = leaf;
+   return true;
+}
+
+// Fill in the node n covering the addresses from prefix on, whose slots are selected by the popStride bits at offset o.
+static bool popNode(PopTrieBuild *b, uint32_t n, uint128t prefix, int o, int i)
+{
+   uint128t lo, hi, size = shl_u128(u64_to_u128t(1), 128 - popStride - o);
+   uint64_t vector = 0, leafvec = 0;
+   int32_t  leaf, last = 0;
+   int      s, k, kind[1 << popStride], first[1 << popStride];
+   uint32_t base0 = b->leafCount, base1;
+
+   for (lo = prefix, s = 0; s < 1 << popStride; s++, lo = add_u128(lo, size))
+   {
+      hi = sub_u128(add_u128(lo, size), u64_to_u128t(1));
+      if ((kind[s] = popSlot(b, lo, hi, &i)) == 2)
+      {
+         vector |= (uint64_t)1 << s;
+         first[s] = i;
+      }
+      else
+      {
+         leaf = (kind[s]) ? i : -1;
+         if (!leafvec || leaf != last)
+         {
+            if (!popLeaf(b, leaf))
+               return false;
+            leafvec |= (uint64_t)1 << s;
+            last = leaf;
+         }
+      }
+   }
+
+   if ((base1 = popNodes(b, __builtin_popcountll(vector))) == UINT32_MAX)
+      return false;
+
+   b->nodes[n] = (PopNode){vector, leafvec, base0, base1};
+
+   for (lo = prefix, k = 0, s = 0; s < 1 << popStride; s++, lo = add_u128(lo, size))
+      if (kind[s] == 2 && !popNode(b, base1 + k++, lo, o + popStride, first[s]))
+         return false;
+
+   return true;
+}
+
+PopTrieIP6 *popTrieIP6Nodes(IP6Set *sortedIP6Sets, int count, void **block)
+{
+   PopTrieBuild b = {NULL, NULL, 0, 0, 0, 0, sortedIP6Sets, count};
+   PopTrieIP6  *trie = NULL;
+   uint32_t    *dir  = allocate((1 << popDirBits)*sizeof(uint32_t), false);
+
+   if (dir)
+   {
+      uint128t lo, hi, size = shl_u128(u64_to_u128t(1), 128 - popDirBits);
+      uint32_t n, s;
+      int      i = 0;
+
+      for (lo = u64_to_u128t(0), s = 0; s < 1 << popDirBits; s++, lo = add_u128(lo, size))
+      {
+         hi = sub_u128(add_u128(lo, size), u64_to_u128t(1));
+         switch (popSlot(&b, lo, hi, &i))
+         {
+            case 0:
+               dir[s] = 0;
+               break;
+
+            case 1:
+               dir[s] = (uint32_t)i + 1;
+               break;
+
+            case 2:
+               if ((n = popNodes(&b, 1)) == UINT32_MAX || !popNode(&b, n, lo, popDirBits, i))
+                  goto quit;
+               dir[s] = n | 0x80000000;
+               break;
+         }
+      }
+
+      // compact the direct table, the nodes and the leaves into one block
+      if (trie = allocateAligned(sizeof(PopTrieIP6) + b.nodeCount*sizeof(PopNode) + b.leafCount*sizeof(int32_t), block))
+      {
+         trie->nodes     = (PopNode *)&trie[1];
+         trie->leaves    = (int32_t *)&trie->nodes[b.nodeCount];
+         trie->nodeCount = b.nodeCount;
+         trie->leafCount = b.leafCount;
+         memcpy(trie->dir,    dir,      sizeof(trie->dir));
+         memcpy(trie->nodes,  b.nodes,  b.nodeCount*sizeof(PopNode));
+         memcpy(trie->leaves, b.leaves, b.leafCount*sizeof(int32_t));
+      }
+   }
+
+quit:
+   deallocate_batch(false, VPR(dir), VPR(b.nodes), VPR(b.leaves), NULL);
+   return trie;
+}
+
+
+#pragma mark ••• Lookup Tables of the IP-Ranges •••
+
+typedef struct
+{
+   const char  *name;
+   LookupEngine engine;
+   bool         ip4, ip6;    // supported IP versions
+} EngineName;
+
+static const EngineName engineNames[] =
+{
+   {"bisection", bisectionEngine, true, true},
+   {"eytzinger", eytzingerEngine, true, true},
+   {"stree",     sTreeEngine,     true, false},
+   {"dir",       dir16Engine,     true, false},  // dir16 to dir24
+   {"poptrie",   popTrieEngine,   false, true},
+   {"learned",   learnedEngine,   true, false},
+   {NULL}
+};
+
+bool parseLookupEngines(char *list, LookupEngine *ip4engine, LookupEngine *ip6engine)
+{
+   *ip4engine = *ip6engine = bisectionEngine;
+
+   for (int n = 0; *list && n < 2; n++)
+   {
+      int tl = taglen(list);
+      int32_t bits = 0;
+      const EngineName *en;
+      for (en = engineNames; en->name; en++)
+         if (en->engine == dir16Engine)
+         {
+            if (tl == 5 && strncmp(en->name, list, 3) == 0 && '0' <= list[3] && list[3] <= '9' && '0' <= list[4] && list[4] <= '9'
+             && 16 <= (bits = (list[3] - '0')*10 + (list[4] - '0')) && bits <= 24)
+               break;
+         }
+         else if (strvlen(en->name) == tl && strncmp(en->name, list, tl) == 0)
+            break;
+
+      if (!en->name)
+         return false;
+
+      if (en->ip4 && (n == 0 || !en->ip6))
+         *ip4engine = (en->engine == dir16Engine) ? dir16Engine + bits - 16 : en->engine;
+      if (en->ip6)
+         *ip6engine = en->engine;
+
+      list += tl;
+      if (*list == ':')
+         list++;
+   }
+
+   return !*list;
+}
+
+
+static bool indexIP4Table(IP4Table *table, LookupEngine engine)
+{
+   table->engine = engine;
+
+   switch (engine)
+   {
+      case eytzingerEngine:
+         table->index = eytzingerIP4Keys(table->sets, table->count, &table->block);
+         break;
+
+   #if defined(__x86_64__)
+      case sTreeEngine:
+         table->index = sTreeIP4Keys(table->sets, table->count, &table->block);
+         break;
+   #endif
+
+      case dir16Engine ... dir24Engine:
+         table->index = dirIP4Slots(table->sets, table->count, engine - dir16Engine + 16, &table->block);
+         break;
+
+      case learnedEngine:
+         table->index = learnedIP4Segments(table->sets, table->count, &table->block);
+         break;
+
+      default:
+         table->engine = bisectionEngine;
+         return true;
+   }
+
+   return table->index != NULL;
+}
+
+IP4Table *loadIP4Table(const char *fname, LookupEngine engine, TableAccess access)
+{
+   IP4Table *table = allocate(sizeof(IP4Table), true);
+   if (table)
+   {
+      if (table->sets = mapSortedTable(fname, access, &table->size))
+      {
+         table->count = (int)(table->size/sizeof(IP4Set));
+         if (indexIP4Table(table, engine))
+            return table;
+
+         unmapSortedTable(table->sets, table->size);
+         errno = ENOMEM;
+      }
+
+      deallocate(VPR(table), false);
+   }
+
+   return NULL;
+}
+
+static bool indexIP6Table(IP6Table *table, LookupEngine engine)
+{
+   table->engine = engine;
+
+   switch (engine)
+   {
+      case eytzingerEngine:
+         table->index = eytzingerIP6Keys(table->sets, table->count, &table->block);
+         break;
+
+      case popTrieEngine:
+         table->index = popTrieIP6Nodes(table->sets, table->count, &table->block);
+         break;
+
+      default:
+         table->engine = bisectionEngine;
+         return true;
+   }
+
+   return table->index != NULL;
+}
+
+IP6Table *loadIP6Table(const char *fname, LookupEngine engine, TableAccess access)
+{
+   IP6Table *table = allocate(sizeof(IP6Table), true);
+   if (table)
+   {
+      if (table->sets = mapSortedTable(fname, access, &table->size))
+      {
+         table->count = (int)(table->size/sizeof(IP6Set));
+         if (indexIP6Table(table, engine))
+            return table;
+
+         unmapSortedTable(table->sets, table->size);
+         errno = ENOMEM;
+      }
+
+      deallocate(VPR(table), false);
+   }
+
+   return NULL;
+}
+
+void releaseIP4Table(IP4Table *table)
+{
+   if (table)
+   {
+      deallocate(VPR(table->block), false);
+      if (table->size)
+         unmapSortedTable(table->sets, table->size);
+      else
+         deallocate(VPR(table->sets), false);
+      deallocate(VPR(table), false);
+   }
+}
+
+void releaseIP6Table(IP6Table *table)
+{
+   if (table)
+   {
+      deallocate(VPR(table->block), false);
+      if (table->size)
+         unmapSortedTable(table->sets, table->size);
+      else
+         deallocate(VPR(table->sets), false);
+      deallocate(VPR(table), false);
+   }
+}
+
+
+#pragma mark ••• Batched Lookups of the IP-Ranges •••
+
+#if defined(__x86_64__)
+
+// AVX2 kernel, which advances batchGroup/8 vectors of 8 bisections per round. The lower bounds of the probes are fetched
+// by gathers, and the unsigned comparisons are done signed on the bounds and addresses with the sign bit flipped.
+__attribute__((target("avx2")))
+static int bisectionIP4SearchAVX2(uint32_t *ip4s, int *indexes, int n, IP4Set *sortedIP4Sets, int count)
+{
+   #define lanes (batchGroup/8)
+
+   const __m256i sign  = _mm256_set1_epi32(0x80000000);
+   const __m256i width = _mm256_set1_epi32(sizeof(IP4Set)/sizeof(uint32_t));
+   const int    *lo = (int *)&sortedIP4Sets[0][0], *hi = (int *)&sortedIP4Sets[0][1];
+   __m256i       ip[lanes], base[lanes], probe, bound, gt;
+   int           i, j, half, len;
+
+   for (i = 0; i + batchGroup <= n; i += batchGroup)
+   {
+      for (j = 0; j < lanes; j++)
+      {
+         ip[j]   = _mm256_xor_si256(_mm256_loadu_si256((__m256i *)&ip4s[i + 8*j]), sign);
+         base[j] = _mm256_setzero_si256();
+      }
+
+      for (len = count; len > 1; len -= half)
+      {
+         half = len >> 1;
+         for (j = 0; j < lanes; j++)
+         {
+            probe   = _mm256_add_epi32(base[j], _mm256_set1_epi32(half));
+            bound   = _mm256_xor_si256(_mm256_i32gather_epi32(lo, _mm256_mullo_epi32(probe, width), 4), sign);
+            gt      = _mm256_cmpgt_epi32(bound, ip[j]);
+            base[j] = _mm256_blendv_epi8(probe, base[j], gt);
+         }
+      }
+
+      for (j = 0; j < lanes; j++)
+      {
+         bound = _mm256_xor_si256(_mm256_i32gather_epi32(lo, _mm256_mullo_epi32(base[j], width), 4), sign);
+         gt    = _mm256_cmpgt_epi32(bound, ip[j]);
+         bound = _mm256_xor_si256(_mm256_i32gather_epi32(hi, _mm256_mullo_epi32(base[j], width), 4), sign);
+         gt    = _mm256_or_si256(gt, _mm256_cmpgt_epi32(ip[j], bound));
+         _mm256_storeu_si256((__m256i *)&indexes[i + 8*j], _mm256_or_si256(base[j], gt));   // -1 if out of the range
+      }
+   }
+
+   return i;
+
+   #undef lanes
+}
+
+#endif
+
+// Branchless lower bound searches -- after the last round, base[j] is the last range with a lower bound <= the address.
+void bisectionIP4SearchBatch(uint32_t *ip4s, int *indexes, int n, IP4Set *sortedIP4Sets, int count)
+{
+#if defined(__x86_64__)
+   if (count && __builtin_cpu_supports("avx2"))
+   {
+      int i = bisectionIP4SearchAVX2(ip4s, indexes, n, sortedIP4Sets, count);
+      ip4s += i, indexes += i, n -= i;
+   }
+#endif
+
+   int i, j, g, half, len, base[batchGroup];
+
+   for (i = 0; i < n; i += g, ip4s += g, indexes += g)
+   {
+      g = (n - i < batchGroup) ? n - i : batchGroup;
+      for (j = 0; j < g; j++)
+         base[j] = 0;
+
+      for (len = count; len > 1; len -= half)
+      {
+         half = len >> 1;
+         for (j = 0; j < g; j++)
+         {
+            base[j] += (sortedIP4Sets[base[j] + half][0] <= ip4s[j]) ? half : 0;
+            __builtin_prefetch(&sortedIP4Sets[base[j] + ((len - half) >> 1)]);
+         }
+      }
+
+      for (j = 0; j < g; j++)
+         indexes[j] = (count && sortedIP4Sets[base[j]][0] <= ip4s[j] && ip4s[j] <= sortedIP4Sets[base[j]][1]) ? base[j] : -1;
+   }
+}
+
+void bisectionIP6SearchBatch(uint128t *ip6s, int *indexes, int n, IP6Set *sortedIP6Sets, int count)
+{
+   int i, j, g, half, len, base[batchGroup];
+
+   for (i = 0; i < n; i += g, ip6s += g, indexes += g)
+   {
+      g = (n - i < batchGroup) ? n - i : batchGroup;
+      for (j = 0; j < g; j++)
+         base[j] = 0;
+
+      for (len = count; len > 1; len -= half)
+      {
+         half = len >> 1;
+         for (j = 0; j < g; j++)
+         {
+            base[j] += le_u128(sortedIP6Sets[base[j] + half][0], ip6s[j]) ? half : 0;
+            __builtin_prefetch(&sortedIP6Sets[base[j] + ((len - half) >> 1)]);
+         }
+      }
+
+      for (j = 0; j < g; j++)
+         indexes[j] = (count && le_u128(sortedIP6Sets[base[j]][0], ip6s[j]) && le_u128(ip6s[j], sortedIP6Sets[base[j]][1])) ? base[j] : -1;
+   }
+}
+
+void tableIP4SearchBatch(uint32_t *ip4s, int *indexes, int n, IP4Table *table)
+{
+   if (table->engine == bisectionEngine)
+      bisectionIP4SearchBatch(ip4s, indexes, n, table->sets, table->count);
+   else
+      for (int i = 0; i < n; i++)
+         indexes[i] = tableIP4Search(ip4s[i], table);
+}
+
+void tableIP6SearchBatch(uint128t *ip6s, int *indexes, int n, IP6Table *table)
+{
+   if (table->engine == bisectionEngine)
+      bisectionIP6SearchBatch(ip6s, indexes, n, table->sets, table->count);
+   else
+      for (int i = 0; i < n; i++)
+         indexes[i] = tableIP6Search(ip6s[i], table);
+}
+
+
+#pragma mark ••• CIDR Prefixes of the IP-Ranges •••
+
+int rangeIP4Prefixes(uint32_t lo, uint32_t hi, IP4Prefix *prefixes)
+{
+   int n = 0;
+
+   if (lo <= hi)
+      for (;;)
+      {
+         uint64_t rest = (uint64_t)hi - lo + 1;          // 1 .. 2^32
+         int32_t  m    = 63 - __builtin_clzll(rest);
+
+         if (lo && __builtin_ctz(lo) < m)
+            m = __builtin_ctz(lo);
+
+         prefixes[n++] = (IP4Prefix){lo, m};
+         if (rest == (uint64_t)1 << m)
+            break;
+
+         lo += (uint32_t)1 << m;
+      }
+
+   return n;
+}
+
+int rangeIP6Prefixes(uint128t lo, uint128t hi, IP6Prefix *prefixes)
+{
+   int n = 0;
+
+   if (le_u128(lo, hi))
+      for (;;)
+      {
+         IP6Desc  a    = {.number = lo},
+                  rest = {.number = sub_u128(hi, lo)};  // the rest of the range - 1, i.e. 0 .. 2^128-1
+         uint128t size = add_u128(rest.number, u64_to_u128t(1));
+         int32_t  m, z;
+
+         // the largest power of 2 not above the rest, which is 2^128 if the rest - 1 has all bits set
+         if (rest.quad[b2_1] == UINT64_MAX && rest.quad[b2_0] == UINT64_MAX)
+            m = 128;
+         else
+         {
+            IP6Desc s = {.number = size};
+            m = (s.quad[b2_1]) ? 127 - __builtin_clzll(s.quad[b2_1]) : 63 - __builtin_clzll(s.quad[b2_0]);
+         }
+
+         z = (a.quad[b2_0]) ? __builtin_ctzll(a.quad[b2_0]) : (a.quad[b2_1]) ? 64 + __builtin_ctzll(a.quad[b2_1]) : 128;
+         if (z < m)
+            m = z;
+
+         prefixes[n++] = (IP6Prefix){lo, m};
+         if (m == 128 || eq_u128(size, shl_u128(u64_to_u128t(1), m)))
+            break;
+
+         lo = add_u128(lo, shl_u128(u64_to_u128t(1), m));
+      }
+
+   return n;
+}
+
+
+#pragma mark ••• Direct Indexed Table of Country Codes •••
+
+
+// Table creation and release
+CCEntry *createCCTable(void)
+{
+   return allocate(ccTableSize*sizeof(CCEntry), true);
+}
+
+void releaseCCTable(CCEntry *table)
+{
+   deallocate(VPR(table), false);
+}
+
+
+// storing/removing country codes
+
+void storeCC(CCEntry *table, char *ccui)
+{
+   int len = strvlen(ccui = trim(ccui));
+   if (len >= 2)
+   {
+      uint32_t idx;
+      int64_t  ui = 0;
+      if ((idx = cci(*(uint16_t *)uppercase(ccui, 2))) < ccTableSize)
+      {
+         if (len > 2)
+         {
+            for (ccui += 2; *ccui && *ccui != '='; ccui++);
+            if (*ccui)
+               ui = strtol(ccui+1, NULL, 10);
+         }
+
+         table[idx] = (CCEntry){1, (0 < ui && ui < 4294967295) ? (uint32_t)ui : 0};
+      }
+   }
+}
+
+void removeCC(CCEntry *table, uint32_t cc)
+{
+   uint32_t idx;
+   if ((idx = cci(cc)) < ccTableSize)
+      table[idx] = (CCEntry){0, 0};
+}
+
+
+#pragma mark ••• Policy Tables •••
+
+// Walk the sorted table and keep the ranges whose country code gets denied, merging the ones that touch each other.
+IP4Table *policyIP4Table(IP4Table *table, CCEntry *ccTable, bool allowMatch, LookupEngine engine)
+{
+   IP4Table *policy = allocate(sizeof(IP4Table), true);
+   if (policy)
+   {
+      int i, n;
+
+      for (n = 0, i = 0; i < table->count; i++)
+         if ((findCC(ccTable, table->sets[i][2]) != NULL) != allowMatch)
+            n++;
+
+      if (policy->sets = allocate(n*sizeof(IP4Set), false))
+      {
+         for (n = -1, i = 0; i < table->count; i++)
+            if ((findCC(ccTable, table->sets[i][2]) != NULL) != allowMatch)
+               if (n >= 0 && policy->sets[n][1] + 1 == table->sets[i][0])
+                  policy->sets[n][1] = table->sets[i][1];
+               else
+               {
+                  policy->sets[++n][0] = table->sets[i][0];
+                  policy->sets[n][1]   = table->sets[i][1];
+                  policy->sets[n][2]   = 0;
+               }
+
+         policy->count = n + 1;
+         if (indexIP4Table(policy, engine))
+            return policy;
+
+         deallocate(VPR(policy->sets), false);
+      }
+
+      deallocate(VPR(policy), false);
+   }
+
+   return NULL;
+}
+
+// The country code is held in the low bytes of the third element, and it is copied out, since a type-punned read
+// would break the strict aliasing rules.
+static inline uint32_t ip6SetCC(IP6Set set)
+{
+   uint32_t cc;
+   memcpy(&cc, &set[2], sizeof(uint32_t));
+   return cc;
+}
+
+IP6Table *policyIP6Table(IP6Table *table, CCEntry *ccTable, bool allowMatch, LookupEngine engine)
+{
+   IP6Table *policy = allocate(sizeof(IP6Table), true);
+   if (policy)
+   {
+      int i, n;
+
+      for (n = 0, i = 0; i < table->count; i++)
+         if ((findCC(ccTable, ip6SetCC(table->sets[i])) != NULL) != allowMatch)
+            n++;
+
+      if (policy->sets = allocate(n*sizeof(IP6Set), false))
+      {
+         for (n = -1, i = 0; i < table->count; i++)
+            if ((findCC(ccTable, ip6SetCC(table->sets[i])) != NULL) != allowMatch)
+               if (n >= 0 && eq_u128(add_u128(policy->sets[n][1], u64_to_u128t(1)), table->sets[i][0]))
+                  policy->sets[n][1] = table->sets[i][1];
+               else
+               {
+                  policy->sets[++n][0] = table->sets[i][0];
+                  policy->sets[n][1]   = table->sets[i][1];
+                  policy->sets[n][2]   = u64_to_u128t(0);
+               }
+
+         policy->count = n + 1;
+         if (indexIP6Table(policy, engine))
+            return policy;
+
+         deallocate(VPR(policy->sets), false);
+      }
+
+      deallocate(VPR(policy), false);
+   }
+
+   return NULL;
+}
+
+// Count the exceptions if verdict is NULL, otherwise fill in the bits and the exceptions.
+static int verdictExceptions(IP4Table *policy, VerdictIP4 *verdict)
+{
+   uint32_t lo, hi, p, last = UINT32_MAX;
+   int      i, j, n = 0;
+
+   for (i = 0; i < policy->count; i++)
+   {
+      lo = policy->sets[i][0], hi = policy->sets[i][1];
+      for (p = lo >> 8;; p++)
+      {
+         if (verdict)
+            verdict->bits[p >> 6] |= (uint64_t)1 << (p & 63);
+
+         // the interval covers the /24 partially, and it is the first interval which overlaps the /24
+         if ((lo > p << 8 || hi < (p << 8 | 0xFF)) && p != last)
+         {
+            if (verdict)
+            {
+               for (j = i + 1; j < policy->count && policy->sets[j][0] >> 8 == p; j++)
+                  ;
+               verdict->except[n] = (VerdictException){p << 8 | (uint32_t)(j - i), i};
+            }
+            last = p;
+            n++;
+         }
+
+         if (p == hi >> 8)
+            break;
+      }
+   }
+
+   return n;
+}
+
+VerdictIP4 *verdictIP4Bitmap(IP4Table *policy, void **block)
+{
+   VerdictIP4 *verdict;
+   int count = verdictExceptions(policy, NULL);
+
+   if (verdict = allocateAligned(sizeof(VerdictIP4) + count*sizeof(VerdictException), block))
+   {
+      memset(verdict->bits, 0, sizeof(verdict->bits));
+      verdict->count = verdictExceptions(policy, verdict);
+   }
+
+   return verdict;
 }
@@ -115,39 +115,520 @@ static inline int bisectionIP6Search(uint128t ip6, IP6Set *sortedIP6Sets, int co
 }
 
 
-#pragma mark ••• AVL Tree of Country Codes •••
+#pragma mark ••• Sort and Sweep Build of the IP-Ranges •••
 
-typedef struct CCNode
+typedef struct
 {
-   uint32_t cc;            // country code
-   uint32_t ui;            // user info
+   uint32_t lo, hi;           // IPv4 number range
+   uint32_t cc;               // country code
+   uint32_t seq;              // the position of the record in the RIR files
+} IP4Record;
+
+typedef struct
+{
+   uint128t lo, hi;           // IPv6 number range
+   uint32_t cc;               // country code
+   uint32_t seq;              // the position of the record in the RIR files
+} IP6Record;
+
+// Sort the records by radix sort on their lower bounds, and consolidate them in one linear sweep into the sets,
+// which must have room for count entries. The result is the same as the one of merging the records in the order
+// of their sequence numbers into the AVL tree by findNet4/6Node(), removeIP4/6Node() and addIP4/6Node().
+// Returns the number of sets, or -1 if the memory for sorting could not be allocated.
+int sweepIP4Records(IP4Record *records, int count, IP4Set *sets);
+int sweepIP6Records(IP6Record *records, int count, IP6Set *sets);
+
+#pragma mark ••• Memory Mapped Binary Sorted Tables •••
+
+typedef enum
+{
+   randomAccess,              // a few lookups only, e.g. a single ipup query -- no read ahead
+   sequentialAccess,          // walking through the whole table, e.g. ipup -t -- aggressive read ahead
+   residentAccess             // lookups by a long running process, e.g. geod -- prefault all pages
+} TableAccess;
+
+// Map the binary sorted table file read-only into memory, so that the IP4Set/IP6Set records may be
+// handed directly to the search functions. All processes mapping the same file share one page-cache copy.
+// Returns the base address of the table and stores its size into *size, or NULL on error with errno set.
+void   *mapSortedTable(const char *fname, TableAccess access, size_t *size);
+void  unmapSortedTable(void *table, size_t size);
+
+// Allocate zeroed memory, which is aligned to the cache lines. The block to be deallocated is stored into *block.
+void *allocateAligned(ssize_t size, void **block);
+
+
+#pragma mark ••• Eytzinger Layout of the IP-Ranges •••
+
+// The lower bounds of the sorted ranges re-arranged in BFS order of the implicit binary search tree, starting at index 1.
+// The children of node k are located at 2k and 2k+1, and so the nodes of 3 (IPv4) or 2 (IPv6) levels further down
+// share one cache line, which can be prefetched while the current level is being compared.
+
+typedef struct
+{
+   uint32_t lo;               // lower bound of the IPv4 range
+   int32_t  o;                // index of the range in the sorted table
+} EytzIP4Key;
+
+typedef struct
+{
+   uint128t lo;               // lower bound of the IPv6 range
+   int32_t  o;                // index of the range in the sorted table
+   int32_t  pad[3];
+} EytzIP6Key;
+
+EytzIP4Key *eytzingerIP4Keys(IP4Set *sortedIP4Sets, int count, void **block);
+EytzIP6Key *eytzingerIP6Keys(IP6Set *sortedIP6Sets, int count, void **block);
+
+static inline int eytzingerIP4Search(uint32_t ip4, EytzIP4Key *keys, IP4Set *sortedIP4Sets, int count)
+{
+   int k;
+   for (k = 1; k <= count;)
+   {
+      __builtin_prefetch(&keys[k << 3]);
+      k = (k << 1) + (keys[k].lo <= ip4);
+   }
+
+   // k is now the node of the first range above ip4 -- with all right turns cancelled out,
+   // or 0, in the case that ip4 is above all the ranges, and the candidate is its predecessor
+   k >>= __builtin_ffs(~k);
+   k = (k) ? keys[k].o - 1 : count - 1;
+   return (k >= 0 && ip4 <= sortedIP4Sets[k][1]) ? k : -1;
+}
+
+static inline int eytzingerIP6Search(uint128t ip6, EytzIP6Key *keys, IP6Set *sortedIP6Sets, int count)
+{
+   int k;
+   for (k = 1; k <= count;)
+   {
+      __builtin_prefetch(&keys[k << 2]);
+      __builtin_prefetch(&keys[(k << 2) + 2]);
+      k = (k << 1) + le_u128(keys[k].lo, ip6);
+   }
+
+   k >>= __builtin_ffs(~k);
+   k = (k) ? keys[k].o - 1 : count - 1;
+   return (k >= 0 && le_u128(ip6, sortedIP6Sets[k][1])) ? k : -1;
+}
+
+
+#pragma mark ••• Static B-Tree of the IPv4-Ranges •••
+
+// A read-only 16-ary search tree over the lower bounds of the sorted IPv4 ranges, one node of 16 keys per cache line.
+// The bottom level contains all the keys in sorted order, and each upper level contains the first key of every node
+// of the level below. The keys are stored with flipped sign bits, so that signed SIMD comparisons can be employed.
+
+#define sTreeB 16             // number of keys per node
+#define sTreeMaxLevels 8      // 16^8 keys are more than an int can count
+
+typedef struct
+{
+   int32_t  levels;
+   int32_t  count[sTreeMaxLevels];     // number of valid keys on each level, bottom level 0
+   int32_t  offset[sTreeMaxLevels];    // position of each level in keys[], top level first
+   uint32_t keys[] __attribute__((aligned(64)));
+} STreeIP4;
+
+STreeIP4 *sTreeIP4Keys(IP4Set *sortedIP4Sets, int count, void **block);
+
+#if defined(__x86_64__)
+
+   // Number of keys in the node which are less than or equal to the biased x
+   static inline int sTreeRank(const uint32_t *node, uint32_t x)
+   {
+   #if defined(__AVX2__)
+      __m256i v = _mm256_set1_epi32((int32_t)x);
+      unsigned m = (unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_load_si256((__m256i *)node),     v)))
+                 | (unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_load_si256((__m256i *)node + 1), v))) << 8;
+   #else
+      __m128i v = _mm_set1_epi32((int32_t)x);
+      unsigned m = (unsigned)_mm_movemask_epi8(_mm_packs_epi16(_mm_packs_epi32(_mm_cmpgt_epi32(_mm_load_si128((__m128i *)node),     v),
+                                                                                _mm_cmpgt_epi32(_mm_load_si128((__m128i *)node + 1), v)),
+                                                               _mm_packs_epi32(_mm_cmpgt_epi32(_mm_load_si128((__m128i *)node + 2), v),
+                                                                                _mm_cmpgt_epi32(_mm_load_si128((__m128i *)node + 3), v))));
+   #endif
+      return sTreeB - __builtin_popcount(m);       // the keys above x form a suffix of the node
+   }
+
+   static inline int sTreeIP4Search(uint32_t ip4, STreeIP4 *tree, IP4Set *sortedIP4Sets, int count)
+   {
+      uint32_t x = ip4 ^ 0x80000000;
+      int c, l, p = 0;
+      for (l = tree->levels - 1; l >= 0; l--)
+      {
+         if (!(c = sTreeRank(&tree->keys[tree->offset[l] + p*sTreeB], x)))
+            return -1;                             // only possible on the top level, i.e. ip4 is below all ranges
+
+         if ((p = p*sTreeB + c - 1) >= tree->count[l])
+            p = tree->count[l] - 1;                // the padding of the last node was counted in
+      }
+
+      return (p >= 0 && p < count && ip4 <= sortedIP4Sets[p][1]) ? p : -1;   // the index must not point beyond the table
+   }
+
+#else
+
+   #define sTreeIP4Search(ip4, tree, sortedIP4Sets, count) bisectionIP4Search(ip4, sortedIP4Sets, count)
+
+#endif
+
+
+#pragma mark ••• Direct Indexed Table of the IPv4-Ranges •••
+
+// The first-level table of the DIR-16 to DIR-24 engines has one slot per 2^(32-bits) addresses, i.e. 2^bits slots of 4 bytes,
+// from 256 kB for 16 bits up to 64 MB for 24 bits. The upper 24 bits of a slot hold an index into the sorted table
+// and the lower 8 bits the number of ranges, which overlap the slot, starting at that index:
+//    0       -- the range at the index covers the whole slot, or dirNone if no range overlaps the slot
+//    1..254  -- the slot is shared by that many ranges, which are to be bisected
+//    dirMaxRun -- the slot is shared by more ranges, bisect up to the end of the table
+
+#define dirNone   0xFFFFFF
+#define dirMaxIndex (dirNone - 1)
+#define dirMaxRun 255
+
+typedef struct
+{
+   int32_t  bits;             // number of leading address bits which index the slots
+   uint32_t slots[];
+} DirIP4;
+
+DirIP4 *dirIP4Slots(IP4Set *sortedIP4Sets, int count, int32_t bits, void **block);
+
+static inline int dirIP4Search(uint32_t ip4, DirIP4 *dir, IP4Set *sortedIP4Sets, int count)
+{
+   uint32_t e = dir->slots[ip4 >> (32 - dir->bits)];
+   int o = (int)(e >> 8), n = (int)(e & 0xFF);
+
+   if (!n)
+      return (o != dirNone) ? o : -1;
+
+   if ((n = bisectionIP4Search(ip4, &sortedIP4Sets[o], (n < dirMaxRun) ? n : count - o)) >= 0)
+      return o + n;
+   else
+      return -1;
+}
+
+
+#pragma mark ••• Learned Index of the IPv4-Ranges •••
+
+// Piecewise linear model of the positions of the lower bounds in the sorted table. The segments are formed by the shrinking
+// cone algorithm, so that the predicted position of each lower bound is off by at most learnedEpsilon. A lookup bisects the
+// few segments for the one of the address, and then bisects the window of +/- (learnedEpsilon + 1) ranges around the
+// predicted position. The segments are followed by a sentinel, whose first member is the count of ranges.
+
+#define learnedEpsilon 8
+
+typedef struct
+{
+   uint32_t key;              // lower bound of the first range in the segment
+   int32_t  first;            // index of the first range in the segment
+   double   slope;
+} LearnedSegment;
+
+typedef struct
+{
+   int32_t  segments;
+   int32_t  maxError;         // actual maximum error of the predicted positions of the lower bounds
+   LearnedSegment seg[];
+} LearnedIP4;
+
+LearnedIP4 *learnedIP4Segments(IP4Set *sortedIP4Sets, int count, void **block);
+
+static inline int learnedIP4Search(uint32_t ip4, LearnedIP4 *model, IP4Set *sortedIP4Sets, int count)
+{
+   LearnedSegment *seg = model->seg;
+   double d;
+   int o, p, q, half, len;
+
+   if (count == 0 || ip4 < sortedIP4Sets[0][0])
+      return -1;
+
+   for (o = 0, len = model->segments; len > 1; len -= half)    // branchless, last segment with a key <= ip4
+   {
+      half = len >> 1;
+      o += (seg[o + half].key <= ip4) ? half : 0;
+   }
+
+   seg = &seg[o];
+   d = seg->slope*(ip4 - seg->key);
+   o = seg->first + ((d < seg[1].first - seg->first) ? (int)d : seg[1].first - seg->first - 1);
+   p = (o - learnedEpsilon - 1 > seg->first)    ? o - learnedEpsilon - 1 : seg->first;
+   q = (o + learnedEpsilon + 1 < seg[1].first) ? o + learnedEpsilon + 1 : seg[1].first - 1;
+
+   for (len = q - p + 1; len > 1; len -= half)                  // last range in the window with a lower bound <= ip4
+   {
+      half = len >> 1;
+      p += (sortedIP4Sets[p + half][0] <= ip4) ? half : 0;
+   }
 
-   int32_t  B;             // house holding
-   struct CCNode *L, *R;
-} CCNode;
+   return (ip4 <= sortedIP4Sets[p][1]) ? p : -1;
+}
+
+
+#pragma mark ••• Multibit Trie of the IPv6-Ranges •••
+
+// Poptrie-style compressed multibit trie. The leading popDirBits of an address index a direct table, whose entries
+// either contain a leaf (bit 31 clear) -- the index of the range covering the whole slot plus 1, or 0 for none -- or
+// the index of a node (bit 31 set). Each node consumes the next popStride bits of the address, and it has one bit per
+// slot in vector for the slots pointing to a child node, while the other slots are leaves, whereby consecutive slots
+// with equal leaves are stored only once, and leafvec marks the slots at which a new leaf starts. The children and
+// leaves of a node are contiguous, and so they are located by counting the bits below the slot -- popcount.
+
+#define popDirBits 20         // 4 MB direct table, the remaining 108 bits are consumed by 18 levels of nodes
+#define popStride  6          // 64 slots per node, one bit per slot in a uint64_t
+
+typedef struct
+{
+   uint64_t vector;           // slots pointing to child nodes
+   uint64_t leafvec;          // slots starting a new leaf
+   uint32_t base0;            // first leaf of the node in leaves[]
+   uint32_t base1;            // first child of the node in nodes[]
+} PopNode;
+
+typedef struct
+{
+   PopNode  *nodes;
+   int32_t  *leaves;          // indexes of the ranges in the sorted table, or -1 for none
+   uint32_t  nodeCount, leafCount;
+   uint32_t  dir[1 << popDirBits];
+} PopTrieIP6;
+
+PopTrieIP6 *popTrieIP6Nodes(IP6Set *sortedIP6Sets, int count, void **block);
+
+static inline int popTrieIP6Search(uint128t ip6, PopTrieIP6 *trie)
+{
+   IP6Desc  a = {.number = ip6};
+   uint64_t hi = a.quad[b2_1], lo = a.quad[b2_0];
+   uint32_t e = trie->dir[hi >> (64 - popDirBits)];
+
+   if (!(e & 0x80000000))
+      return (int)e - 1;
+
+   PopNode *node = &trie->nodes[e & 0x7FFFFFFF];
+   for (int o = popDirBits;; o += popStride)
+   {
+      uint32_t s = (uint32_t)(((o < 64) ? hi << o | lo >> (64 - o) : lo << (o - 64)) >> (64 - popStride));
+      uint64_t m = ((uint64_t)2 << s) - 1;        // slots 0 to s
+      if (node->vector >> s & 1)
+         node = &trie->nodes[node->base1 + __builtin_popcountll(node->vector & m) - 1];
+      else
+         return trie->leaves[node->base0 + __builtin_popcountll(node->leafvec & m) - 1];
+   }
+}
+
+
+#pragma mark ••• Lookup Tables of the IP-Ranges •••
+
+typedef enum
+{
+   bisectionEngine,           // binary search in the sorted table
+   eytzingerEngine,           // branchless search in the Eytzinger layout of the sorted table
+   sTreeEngine,               // SIMD search in the static 16-ary B-tree of the IPv4 ranges, bisection on non-x86
+   dir16Engine,               // direct indexed first-level table with 2^16 slots of the IPv4 ranges
+   dir24Engine = dir16Engine + 8, // ... up to 2^24 slots
+   popTrieEngine,             // compressed multibit trie of the IPv6 ranges
+   learnedEngine              // piecewise linear model of the positions of the IPv4 ranges
+} LookupEngine;
+
+// Parse the engine selection, i.e. either one engine for both IP versions, or two engines separated by colon.
+// An engine which supports only one IP version is assigned to that one. Returns false if a name is unknown.
+bool parseLookupEngines(char *list, LookupEngine *ip4engine, LookupEngine *ip6engine);
+
+typedef struct
+{
+   IP4Set      *sets;         // the binary sorted table mapped into memory
+   size_t       size;         // the size of the mapping, or 0 if the sets were allocated, e.g. by policyIP4Table()
+   int          count;
+   LookupEngine engine;
+   void        *index;        // the cache line aligned search structure of the engine, if any
+   void        *block;        // the allocated memory block which contains the index
+} IP4Table;
+
+typedef struct
+{
+   IP6Set      *sets;
+   size_t       size;         // 0 if the sets were allocated, e.g. by policyIP6Table()
+   int          count;
+   LookupEngine engine;
+   void        *index;
+   void        *block;
+} IP6Table;
+
+IP4Table   *loadIP4Table(const char *fname, LookupEngine engine, TableAccess access);
+IP6Table   *loadIP6Table(const char *fname, LookupEngine engine, TableAccess access);
+void     releaseIP4Table(IP4Table *table);
+void     releaseIP6Table(IP6Table *table);
+
+static inline int tableIP4Search(uint32_t ip4, IP4Table *table)
+{
+   switch (table->engine)
+   {
+      case eytzingerEngine:
+         return eytzingerIP4Search(ip4, table->index, table->sets, table->count);
+
+      case sTreeEngine:
+         return sTreeIP4Search(ip4, table->index, table->sets, table->count);
+
+      case dir16Engine ... dir24Engine:
+         return dirIP4Search(ip4, table->index, table->sets, table->count);
+
+      case learnedEngine:
+         return learnedIP4Search(ip4, table->index, table->sets, table->count);
+
+      default:
+         return bisectionIP4Search(ip4, table->sets, table->count);
+   }
+}
+
+static inline int tableIP6Search(uint128t ip6, IP6Table *table)
+{
+   switch (table->engine)
+   {
+      case eytzingerEngine:
+         return eytzingerIP6Search(ip6, table->index, table->sets, table->count);
+
+      case popTrieEngine:
+         return popTrieIP6Search(ip6, table->index);
+
+      default:
+         return bisectionIP6Search(ip6, table->sets, table->count);
+   }
+}
+
+
+#pragma mark ••• Batched Lookups of the IP-Ranges •••
 
-CCNode *findCCNode(uint32_t cc, CCNode  *node);
-int      addCCNode(uint32_t cc, uint32_t ui, CCNode **node);
-int   removeCCNode(uint32_t cc, CCNode **node);
-void releaseCCTree(CCNode *node);
+// The batched searches resolve n addresses at once into the indexes of their ranges, or -1 for none. The bisections of
+// a group of batchGroup addresses advance in lockstep, and the next probe of each is prefetched, so that the cache misses
+// of the group overlap, instead of stalling each search on its own. On AVX2 capable x86 machines, which is detected at runtime,
+// the IPv4 bisections run 8 per vector with gathers of the lower bounds. The engines other than bisection are walked per address.
 
+#define batchGroup 16
 
-#pragma mark ••• Pseudo Hash Table of Country Codes •••
+void bisectionIP4SearchBatch(uint32_t *ip4s, int *indexes, int n, IP4Set *sortedIP4Sets, int count);
+void bisectionIP6SearchBatch(uint128t *ip6s, int *indexes, int n, IP6Set *sortedIP6Sets, int count);
+
+void tableIP4SearchBatch(uint32_t *ip4s, int *indexes, int n, IP4Table *table);
+void tableIP6SearchBatch(uint128t *ip6s, int *indexes, int n, IP6Table *table);
+
+
+#pragma mark ••• CIDR Prefixes of the IP-Ranges •••
+
+// Decompose the range lo..hi into the minimal ascending list of CIDR prefixes, whereby each prefix is the largest
+// block, which is aligned at its address and fits into the rest of the range -- its length follows from the count
+// of the trailing zero bits of the address and the count of the leading zero bits of the rest of the range.
+// The prefixes are written to the caller's buffer of at least maxIP4Prefixes or maxIP6Prefixes entries,
+// and the count of the prefixes is returned.
+
+#define maxIP4Prefixes 64
+#define maxIP6Prefixes 256
+
+typedef struct
+{
+   uint32_t ip;
+   int32_t  m;                // the number of host bits, i.e. the mask length is 32 - m
+} IP4Prefix;
+
+typedef struct
+{
+   uint128t ip;
+   int32_t  m;                // the number of host bits, i.e. the mask length is 128 - m
+} IP6Prefix;
+
+int rangeIP4Prefixes(uint32_t lo, uint32_t hi, IP4Prefix *prefixes);
+int rangeIP6Prefixes(uint128t lo, uint128t hi, IP6Prefix *prefixes);
+
+
+#pragma mark ••• Direct Indexed Table of Country Codes •••
+
+// The country codes AA to ZZ map one-to-one onto the 676 entries of the table, and
+// an entry holds the present flag and the user info of its country code.
 
 #define ccTableSize 676
 
+typedef struct
+{
+   uint32_t present;       // 1 if the country code is in the table
+   uint32_t ui;            // user info
+} CCEntry;
+
 static inline uint32_t cce(uint16_t cc)
 {
    uint8_t *ca = (uint8_t *)&cc;
    return (ca[b2_0]-'A')*26 + (ca[b2_1]-'A');   // AA to ZZ ranges from 0 to 675
 }
 
-CCNode **createCCTable(void);
-void    releaseCCTable(CCNode *table[]);
+static inline uint32_t cci(uint32_t cc)
+{
+   uint16_t c  = (uint16_t)cc;
+   uint8_t *ca = (uint8_t *)&c;
+   uint32_t a  = ca[b2_0]-'A', b = ca[b2_1]-'A';
+   return (a < 26 && b < 26) ? a*26 + b : ccTableSize;    // ccTableSize for any code which is not 2 capital letters
+}
+
+CCEntry *createCCTable(void);
+void    releaseCCTable(CCEntry *table);
+
+static inline CCEntry *findCC(CCEntry *table, uint32_t cc)
+{
+   uint32_t idx = cci(cc);
+   return (idx < ccTableSize && table[idx].present) ? &table[idx] : NULL;
+}
+
+void storeCC(CCEntry *table, char *ccui);
+void removeCC(CCEntry *table, uint32_t cc);
+
+
+#pragma mark ••• Policy Tables •••
+
+// The policy table contains the merged ranges of the sorted table whose source addresses are to be denied, i.e.
+// those of the countries not in the CC table if allowMatch, or those of the countries in the CC table otherwise.
+// The other addresses, including the ones not in any range, pass. The engine builds its index over the policy table.
+
+IP4Table *policyIP4Table(IP4Table *table, CCEntry *ccTable, bool allowMatch, LookupEngine engine);
+IP6Table *policyIP6Table(IP6Table *table, CCEntry *ccTable, bool allowMatch, LookupEngine engine);
+
+// The verdict bitmap has one bit per /24, which is set if any address of the /24 is denied. The /24s which are shared
+// by denied and passed addresses are exceptions, which are listed in ascending order together with the index and
+// the number of the intervals of the policy table overlapping them. So, a passed /24 takes a single bit test, and a
+// denied one a bisection of the exceptions, and only the addresses in the exceptions need to bisect a few intervals.
+
+typedef struct
+{
+   uint32_t prefix;           // the upper 24 bits of the addresses in the /24 << 8 | the number of overlapping intervals
+   int32_t  first;            // the index of the first overlapping interval of the policy table
+} VerdictException;
+
+typedef struct
+{
+   uint64_t bits[(1 << 24)/64];
+   int32_t  count;            // the number of exceptions
+   VerdictException except[];
+} VerdictIP4;
+
+VerdictIP4 *verdictIP4Bitmap(IP4Table *policy, void **block);
+
+static inline bool verdictIP4Denied(uint32_t ip4, VerdictIP4 *verdict, IP4Set *policySets)
+{
+   uint32_t p = ip4 >> 8;
+   int o, q;
+
+   if (!(verdict->bits[p >> 6] >> (p & 63) & 1))
+      return false;
 
-CCNode *findCC(CCNode *table[], uint32_t cc);
-void   storeCC(CCNode *table[], char *ccui);
-void  removeCC(CCNode *table[], uint32_t cc);
+   for (o = 0, q = verdict->count - 1; o <= q;)
+   {
+      int m = (o + q) >> 1;
+      uint32_t e = verdict->except[m].prefix >> 8;
+      if (e == p)
+         return bisectionIP4Search(ip4, &policySets[verdict->except[m].first], verdict->except[m].prefix & 0xFF) >= 0;
+      else if (e < p)
+         o = m + 1;
+      else
+         q = m - 1;
+   }
+
+   return true;
+}
 
 
 
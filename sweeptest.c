@@ -0,0 +1,266 @@
+//  sweeptest.c
+//  sweeptest
+//
+//  Created by Dr. Rolf Jansen on 2026-10-16.
+//  Copyright © 2026 projectworld.net. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification,
+//  are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS
+//  OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+//  AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER
+//  OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+//  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+//  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+//  IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+//  THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  make sweeptest && ./sweeptest  -- or make test
+//
+//  Cross checks the sort and sweep build of the IP-Ranges by sweepIP4Records() and sweepIP6Records() against the
+//  former build of ipdb, which merged each record in the order of the RIR files into one global AVL tree. The record
+//  sets are random, but crowded around a few spots, including the beginning and the end of the address spaces, so
+//  that records of different registries with different country codes overlap, duplicate and touch each other, and
+//  touching records of the same country code are joined. The sweep replays the overlapping chains through fresh
+//  trees of other shapes than the one of the global tree, and so the tables must be the same, independent of that.
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#include "binutils.h"
+#include "store.h"
+#include "testutils.h"
+
+
+// a few country codes of different registries, so that overlapping records often disagree
+static uint32_t randomCC(void)
+{
+   static const char *codes[] = {"DE", "US", "BR", "ZA", "JP"};
+   const char *cc = codes[xorshift() % ((xorshift() & 1) ? 2 : 5)];
+   return *(uint16_t *)cc;
+}
+
+
+#pragma mark ••• IPv4 •••
+
+static void randomIP4Records(IP4Record *records, int count)
+{
+   static const uint32_t spots[] = {0, 0x0A000000, 0x7FFFFF00, UINT32_MAX - 1023};
+   int i;
+
+   for (i = 0; i < count; i++)
+   {
+      uint32_t lo, hi, width = (xorshift() % 8) ? (uint32_t)(xorshift() % 64) : (uint32_t)(xorshift() >> (44 + xorshift() % 20));
+      uint64_t r = xorshift() % 16;
+      IP4Record *prev = (i) ? &records[xorshift() % i] : NULL;
+
+      if (prev && r < 3)         // the same range from another registry
+         lo = prev->lo, hi = prev->hi;
+      else if (prev && r < 6)    // a range touching another one
+         if (prev->hi < UINT32_MAX)
+            lo = prev->hi + 1, hi = (lo + width < lo) ? UINT32_MAX : lo + width;
+         else
+            hi = prev->lo - 1, lo = (hi < width) ? 0 : hi - width;
+      else if (prev && r < 9)    // a range overlapping another one
+         lo = prev->lo + (uint32_t)(xorshift() % ((uint64_t)prev->hi - prev->lo + 1)), hi = (lo + width < lo) ? UINT32_MAX : lo + width;
+      else if (r < 15)
+         lo = spots[xorshift() % 4] + (uint32_t)(xorshift() % 1024), hi = (lo + width < lo) ? UINT32_MAX : lo + width;
+      else
+         lo = (uint32_t)xorshift(), hi = (lo + width < lo) ? UINT32_MAX : lo + width;
+
+      records[i] = (IP4Record){lo, hi, randomCC(), i};
+   }
+}
+
+static int formerIP4Build(IP4Record *records, int count, IP4Set *sets)
+{
+   IP4Node *tree = NULL, *node;
+   int      i, n;
+
+   for (i = 0; i < count; i++)
+   {
+      uint32_t lo = records[i].lo, hi = records[i].hi, cc = records[i].cc;
+      while (node = findNet4Node(lo, hi, cc, tree))
+      {
+         if (node->lo < lo)
+            lo = node->lo;
+
+         if (node->hi > hi)
+            hi = node->hi;
+
+         removeIP4Node(node->lo, &tree);
+      }
+
+      addIP4Node(lo, hi, cc, &tree);
+   }
+
+   // in-order traversal without recursion, by means of a small stack of the left spine
+   IP4Node *stack[64];
+   int      depth = 0;
+   for (n = 0, node = tree; node || depth;)
+      if (node)
+         stack[depth++] = node, node = node->L;
+      else
+      {
+         node = stack[--depth];
+         sets[n][0] = node->lo, sets[n][1] = node->hi, sets[n][2] = node->cc, n++;
+         node = node->R;
+      }
+
+   releaseIP4Tree(tree);
+   return n;
+}
+
+static long checkIP4(int count)
+{
+   IP4Record *records = allocate(count*sizeof(IP4Record), false), *copy = allocate(count*sizeof(IP4Record), false);
+   IP4Set    *sets    = allocate(count*sizeof(IP4Set), false),    *former = allocate(count*sizeof(IP4Set), false);
+   long       errors  = 0;
+
+   randomIP4Records(records, count);
+   memcpy(copy, records, count*sizeof(IP4Record));
+
+   int f = formerIP4Build(records, count, former),
+       n = sweepIP4Records(copy, count, sets);
+
+   if (n != f || memcmp(sets, former, n*sizeof(IP4Set)) != 0)
+   {
+      errors++;
+      printf("IPv4 %d records: %d sets, but %d by the former build\n", count, n, f);
+   }
+
+   deallocate_batch(false, VPR(records), VPR(copy), VPR(sets), VPR(former), NULL);
+   return errors;
+}
+
+
+#pragma mark ••• IPv6 •••
+
+static void randomIP6Records(IP6Record *records, int count)
+{
+   uint128t one = u64_to_u128t(1), ones = sub_u128(u64_to_u128t(0), one),
+            spots[] = {u64_to_u128t(0), u128(0x2001067C00000000, 0), u128(0x7FFFFFFFFFFFFFFF, UINT64_MAX - 1023), sub_u128(ones, u64_to_u128t(1023))};
+   int i;
+
+   for (i = 0; i < count; i++)
+   {
+      uint128t lo, hi, width = (xorshift() % 8) ? u64_to_u128t(xorshift() % 64) : shr_u128(u128(xorshift(), xorshift()), 20 + (uint32_t)(xorshift() % 108));
+      uint64_t r = xorshift() % 16;
+      IP6Record *prev = (i) ? &records[xorshift() % i] : NULL;
+
+      if (prev && r < 3)         // the same range from another registry
+         lo = prev->lo, hi = prev->hi;
+      else if (prev && r < 6)    // a range touching another one
+         if (lt_u128(prev->hi, ones))
+            lo = add_u128(prev->hi, one), hi = lt_u128(hi = add_u128(lo, width), lo) ? ones : hi;
+         else
+            hi = sub_u128(prev->lo, one), lo = lt_u128(hi, width) ? u64_to_u128t(0) : sub_u128(hi, width);
+      else if (prev && r < 9)    // a range overlapping another one
+         lo = lt_u128(lo = add_u128(prev->lo, width), prev->lo) || gt_u128(lo, prev->hi) ? prev->hi : lo,
+         hi = lt_u128(hi = add_u128(lo, width), lo) ? ones : hi;
+      else if (r < 15)
+         lo = add_u128(spots[xorshift() % 4], u64_to_u128t(xorshift() % 1024)), hi = lt_u128(hi = add_u128(lo, width), lo) ? ones : hi;
+      else
+         lo = u128(xorshift(), xorshift()), hi = lt_u128(hi = add_u128(lo, width), lo) ? ones : hi;
+
+      records[i] = (IP6Record){lo, hi, randomCC(), i};
+   }
+}
+
+static int formerIP6Build(IP6Record *records, int count, IP6Set *sets)
+{
+   IP6Node *tree = NULL, *node;
+   int      i, n;
+
+   for (i = 0; i < count; i++)
+   {
+      uint128t lo = records[i].lo, hi = records[i].hi;
+      uint32_t cc = records[i].cc;
+      while (node = findNet6Node(lo, hi, cc, tree))
+      {
+         if (lt_u128(node->lo, lo))
+            lo = node->lo;
+
+         if (gt_u128(node->hi, hi))
+            hi = node->hi;
+
+         removeIP6Node(node->lo, &tree);
+      }
+
+      addIP6Node(lo, hi, cc, &tree);
+   }
+
+   IP6Node *stack[64];
+   int      depth = 0;
+   for (n = 0, node = tree; node || depth;)
+      if (node)
+         stack[depth++] = node, node = node->L;
+      else
+      {
+         node = stack[--depth];
+         sets[n][0] = node->lo, sets[n][1] = node->hi, sets[n][2] = u64_to_u128t(node->cc), n++;
+         node = node->R;
+      }
+
+   releaseIP6Tree(tree);
+   return n;
+}
+
+static long checkIP6(int count)
+{
+   IP6Record *records = allocate(count*sizeof(IP6Record), false), *copy = allocate(count*sizeof(IP6Record), false);
+   IP6Set    *sets    = allocate(count*sizeof(IP6Set), false),    *former = allocate(count*sizeof(IP6Set), false);
+   long       errors  = 0;
+
+   randomIP6Records(records, count);
+   memcpy(copy, records, count*sizeof(IP6Record));
+
+   int f = formerIP6Build(records, count, former),
+       n = sweepIP6Records(copy, count, sets);
+
+   if (n != f || memcmp(sets, former, n*sizeof(IP6Set)) != 0)
+   {
+      errors++;
+      printf("IPv6 %d records: %d sets, but %d by the former build\n", count, n, f);
+   }
+
+   deallocate_batch(false, VPR(records), VPR(copy), VPR(sets), VPR(former), NULL);
+   return errors;
+}
+
+
+int main(int argc, const char *argv[])
+{
+   long checks, errors, failed;
+   int  i;
+
+   // many small record sets, in which most records belong to overlapping chains, and a few large ones
+   for (checks = errors = 0, i = 0; i < 20000; i++, checks++)
+      errors += checkIP4(1 + (int)(xorshift() % 300));
+   for (i = 0; i < 20; i++, checks++)
+      errors += checkIP4(50000);
+   printf("IPv4: %ld record sets checked, %ld errors\n", checks, errors);
+   failed = errors;
+
+   for (checks = errors = 0, i = 0; i < 20000; i++, checks++)
+      errors += checkIP6(1 + (int)(xorshift() % 300));
+   for (i = 0; i < 20; i++, checks++)
+      errors += checkIP6(50000);
+   printf("IPv6: %ld record sets checked, %ld errors\n", checks, errors);
+   failed += errors;
+
+   return (failed) ? 1 : 0;
+}